@@ -0,0 +1,134 @@
+// Generatore di programmi K sintetici per misurare come crescono i tempi
+// e la memoria di kcomp al crescere del programma. Il programma generato
+// (su stdout) è determinato dai parametri:
+//   -f N  numero di funzioni
+//   -d N  profondità di annidamento dei blocchi (ogni blocco, tranne quelli
+//         più interni, contiene un for, un if e un blocco annidati)
+//   -e N  profondità delle espressioni (catene di N operatori binari)
+//   -s N  statement per blocco
+//   -v N  variabili definite in ogni blocco
+//   -g N  variabili globali
+//   -r N  seme del generatore pseudocasuale
+// Ogni funzione chiama quelle definite prima, per cui il programma è
+// anche un test per la risoluzione dei nomi e per la cache delle funzioni
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static unsigned functions = 100, depth = 3, expdepth = 4, stmts = 4, vars = 2, globals = 10;
+static std::mt19937 rng(1);
+
+static unsigned pick(unsigned n) {
+  return std::uniform_int_distribution<unsigned>(0, n - 1)(rng);
+}
+
+// Nomi visibili nel punto di generazione corrente (parametri, variabili dei
+// blocchi che lo racchiudono e globali)
+static std::vector<std::string> scope;
+
+// Operando: una costante, una chiamata di una funzione già definita o,
+// con probabilità 1/2, un nome visibile
+static std::string operand(unsigned fun) {
+  unsigned kind = pick(4);
+  if (kind == 0)
+    return std::to_string(pick(100)) + "." + std::to_string(pick(10));
+  if (kind == 1 && fun > 0)
+    return "f" + std::to_string(pick(fun)) + "(" + scope[pick(scope.size())] + ", " +
+           scope[pick(scope.size())] + ")";
+  return scope[pick(scope.size())];
+}
+
+static std::string exp(unsigned fun) {
+  static const char* ops[] = {" + ", " - ", " * ", " / "};
+  std::string e = operand(fun);
+  for (unsigned i = 0; i < expdepth; i++)
+    e += ops[pick(4)] + operand(fun);
+  return e;
+}
+
+static std::string cond(unsigned fun) {
+  return exp(fun) + (pick(2) ? " < " : " == ") + operand(fun);
+}
+
+static void block(unsigned fun, unsigned level, unsigned indent);
+
+static void stmt(unsigned fun, unsigned level, unsigned k, unsigned indent) {
+  std::string pad(indent, ' ');
+  // I primi statement dei blocchi non più interni contengono i blocchi
+  // del livello successivo
+  if (level < depth && k < 3) {
+    switch (k) {
+    case 0: {
+      std::string i = "i" + std::to_string(level);
+      printf("%sfor (var %s = 0; %s < %u; %s = %s + 1)\n%s  ", pad.c_str(), i.c_str(), i.c_str(),
+             1 + pick(10), i.c_str(), i.c_str(), pad.c_str());
+      scope.push_back(i);
+      block(fun, level + 1, indent + 2);
+      scope.pop_back();
+      break;
+    }
+    case 1:
+      printf("%sif (%s)\n%s  ", pad.c_str(), cond(fun).c_str(), pad.c_str());
+      block(fun, level + 1, indent + 2);
+      printf("\n%selse\n%s  %s", pad.c_str(), pad.c_str(), exp(fun).c_str());
+      break;
+    default:
+      printf("%s", pad.c_str());
+      block(fun, level + 1, indent);
+    }
+    return;
+  }
+  // Gli altri sono assegnamenti a variabili locali o globali
+  printf("%s%s = %s", pad.c_str(), scope[pick(scope.size())].c_str(), exp(fun).c_str());
+}
+
+static void block(unsigned fun, unsigned level, unsigned indent) {
+  std::string pad(indent, ' ');
+  size_t outer = scope.size();
+  printf("{\n");
+  for (unsigned i = 0; i < vars; i++) {
+    std::string v = "v" + std::to_string(level) + "_" + std::to_string(i);
+    printf("%s  var %s = %s;\n", pad.c_str(), v.c_str(), exp(fun).c_str());
+    scope.push_back(v);
+  }
+  for (unsigned k = 0; k < stmts; k++) {
+    stmt(fun, level, k, indent + 2);
+    printf(";\n");
+  }
+  printf("%s  %s\n%s}", pad.c_str(), exp(fun).c_str(), pad.c_str());
+  scope.resize(outer);
+}
+
+int main(int argc, char* argv[]) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    unsigned v = atoi(argv[i + 1]);
+    if (!strcmp(argv[i], "-f"))      functions = v;
+    else if (!strcmp(argv[i], "-d")) depth = v;
+    else if (!strcmp(argv[i], "-e")) expdepth = v;
+    else if (!strcmp(argv[i], "-s")) stmts = v;
+    else if (!strcmp(argv[i], "-v")) vars = v;
+    else if (!strcmp(argv[i], "-g")) globals = v;
+    else if (!strcmp(argv[i], "-r")) rng.seed(v);
+    else {
+      fprintf(stderr, "uso: genk [-f N] [-d N] [-e N] [-s N] [-v N] [-g N] [-r N]\n");
+      return 1;
+    }
+  }
+  for (unsigned g = 0; g < globals; g++) {
+    printf("global g%u;\n", g);
+    scope.push_back("g" + std::to_string(g));
+  }
+  size_t globalscope = scope.size();
+  for (unsigned f = 0; f < functions; f++) {
+    printf("def f%u(a b) ", f);
+    scope.push_back("a");
+    scope.push_back("b");
+    block(f, 0, 0);
+    printf(";\n");
+    scope.resize(globalscope);
+  }
+  return 0;
+}
@@ -0,0 +1,235 @@
+// Microbenchmark dei componenti di kcomp, sul modello di Google Benchmark:
+// scanner (yylex su un programma in memoria), parser (senza generazione del
+// codice) e generazione del codice dei singoli tipi di nodo dell'AST
+// (alberi profondi di BinaryExprAST, catene di IfExprAST, ForExprAST
+// annidati, espressioni annidate per 10^5 livelli). Ogni benchmark viene
+// ripetuto, raddoppiando le iterazioni, finché il tempo misurato non supera
+// quello minimo (-t SECONDI, default 0.5); il risultato è il tempo per
+// iterazione e il numero di elementi (token o nodi) elaborati al secondo.
+// Un argomento diverso da -t seleziona i benchmark il cui nome contiene
+// l'argomento
+#include "../driver.hpp"
+#include <chrono>
+#include <cstring>
+#include <functional>
+
+// Stato di un benchmark: il corpo ripete iterations volte l'operazione da
+// misurare e riporta in items gli elementi elaborati in ciascuna. Come in
+// Google Benchmark, il tempo è misurato soltanto fra ResumeTiming e
+// PauseTiming: la costruzione del driver e degli alberi in ingresso e la
+// loro eliminazione restano fuori dalla misura
+struct State {
+  uint64_t iterations;
+  uint64_t items = 0;
+  double elapsed = 0;   // Secondi misurati
+  std::chrono::steady_clock::time_point start;
+
+  void ResumeTiming() {
+    start = std::chrono::steady_clock::now();
+  }
+  void PauseTiming() {
+    elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+};
+
+struct Benchmark {
+  const char* name;
+  std::function<void(State&)> body;
+};
+
+static std::vector<Benchmark>& benchmarks() {
+  static std::vector<Benchmark> B;
+  return B;
+}
+
+struct Registrar {
+  Registrar(const char* name, std::function<void(State&)> body) {
+    benchmarks().push_back({name, body});
+  }
+};
+
+#define BENCHMARK(fn) static Registrar registrar_##fn(#fn, fn)
+
+// Il programma usato da scanner e parser: funzioni generate con la stessa
+// struttura di quelle di test_progetto
+static const std::string& program() {
+  static std::string text;
+  if (text.empty())
+    for (int i = 0; i < 500; i++) {
+      std::string f = "f" + std::to_string(i);
+      text += "global g" + std::to_string(i) + ";\n";
+      text += "def " + f + "(y x) {\n"
+              "   var eps = 0.0001;\n"
+              "   for (var z = x*x; eps<err(z,y) and not (z == y); x = (x+y/x)/2) z = x*x;\n"
+              "   y<1 ? x+" + std::to_string(i) + " : (y == 2 ? x-1 : x*x*x)\n"
+              "};\n";
+    }
+  return text;
+}
+
+/*********************** Scanner e parser ***********************/
+static void BM_Lex(State& state) {
+  driver drv;
+  state.ResumeTiming();
+  for (uint64_t i = 0; i < state.iterations; i++) {
+    drv.source = program();
+    drv.file = "<program>";
+    drv.location.initialize(&drv.file);
+    drv.scan_begin();
+    uint64_t tokens = 0;
+    while (yylex(drv, drv.scanner).kind() != yy::parser::symbol_kind::S_YYEOF)
+      tokens++;
+    drv.scan_end();
+    drv.source = StringRef();
+    state.items = tokens;
+  }
+  state.PauseTiming();
+}
+BENCHMARK(BM_Lex);
+
+// Il parsing costruisce l'AST ma non genera codice: come per la generazione
+// parallela (threads > 1) il driver si limita a raccogliere gli elementi di
+// primo livello, che vengono poi liberati
+static void BM_Parse(State& state) {
+  driver drv;
+  drv.threads = 2;
+  for (uint64_t i = 0; i < state.iterations; i++) {
+    uint64_t tokens = drv.Stats.tokens;
+    state.ResumeTiming();
+    if (drv.parse_string(program(), "<program>"))
+      exit(1);
+    state.PauseTiming();
+    state.items = drv.Stats.tokens - tokens;
+    for (RootAST* item : drv.Items)
+      delete item;
+    drv.Items.clear();
+  }
+}
+BENCHMARK(BM_Parse);
+
+/*********************** Generazione del codice ***********************/
+// La generazione del codice di un'espressione avviene nel corpo di una
+// funzione bench(x), creata e poi eliminata a ogni iterazione; l'eliminazione
+// non fa parte della misura. L'albero E viene liberato al termine
+static void codegen_expr(State& state, driver& drv, ExprAST* E, uint64_t nodes) {
+  symbol x = drv.intern("x");
+  FunctionType* FT = FunctionType::get(drv.builder->getDoubleTy(), {drv.builder->getDoubleTy()}, false);
+  for (uint64_t i = 0; i < state.iterations; i++) {
+    state.ResumeTiming();
+    Function* F = Function::Create(FT, Function::ExternalLinkage, "bench", *drv.module);
+    drv.builder->SetInsertPoint(BasicBlock::Create(*drv.context, "entry", F));
+    AllocaInst* A = drv.builder->CreateAlloca(drv.builder->getDoubleTy(), nullptr, "x");
+    drv.builder->CreateStore(F->getArg(0), A);
+    drv.NamedValues.push_scope();
+    drv.NamedValues.bind(x, A);
+    drv.builder->CreateRet(E->codegen(drv));
+    state.PauseTiming();
+    drv.NamedValues.clear();
+    F->eraseFromParent();
+  }
+  state.items = nodes;
+  delete E;
+}
+
+// x+1-x*2+x/3... : un albero di BinaryExprAST profondo n
+static void BM_BinaryExpr(State& state) {
+  driver drv;
+  const int n = 1000;
+  static const char ops[] = "+-*/";
+  ExprAST* E = new VariableExprAST(drv.intern("x"));
+  for (int i = 0; i < n; i++)
+    E = new BinaryExprAST(ops[i % 4], E, i % 2 ? (ExprAST*) new NumberExprAST(i)
+                                               : new VariableExprAST(drv.intern("x")));
+  codegen_expr(state, drv, E, 2 * n + 1);
+}
+BENCHMARK(BM_BinaryExpr);
+
+// x<0 ? 0 : (x<1 ? 1 : (x<2 ? 2 : ...)) : una catena di n IfExprAST
+static void BM_IfChain(State& state) {
+  driver drv;
+  const int n = 200;
+  symbol x = drv.intern("x");
+  ExprAST* E = new NumberExprAST(n);
+  for (int i = n - 1; i >= 0; i--)
+    E = new IfExprAST(new BinaryExprAST('<', new VariableExprAST(x), new NumberExprAST(i)),
+                      new NumberExprAST(i), E);
+  codegen_expr(state, drv, E, 5 * n + 1);
+}
+BENCHMARK(BM_IfChain);
+
+// for (var i0 = 0; i0 < x; i0 = i0+1) for (var i1 = 0; ...) ... x = x+1:
+// n ForExprAST annidati
+static void BM_NestedFor(State& state) {
+  driver drv;
+  const int n = 50;
+  symbol x = drv.intern("x");
+  ExprAST* E = new AssignmentExprAST(x, new BinaryExprAST('+', new VariableExprAST(x), new NumberExprAST(1)));
+  for (int k = n - 1; k >= 0; k--) {
+    symbol i = drv.intern("i" + std::to_string(k));
+    E = new ForExprAST(new VarBindingAST(i, new NumberExprAST(0)),
+                       new BinaryExprAST('<', new VariableExprAST(i), new VariableExprAST(x)),
+                       new AssignmentExprAST(i, new BinaryExprAST('+', new VariableExprAST(i),
+                                                                  new NumberExprAST(1))),
+                       E);
+  }
+  codegen_expr(state, drv, E, 10 * n + 4);
+}
+BENCHMARK(BM_NestedFor);
+
+// Espressioni annidate per 10^5 livelli, il cui codice viene generato con
+// uno stack esplicito: un polinomio in forma di Horner
+// (...((x*x+1)*x+2)*x+...), profondo n moltiplicazioni e n addizioni, e una
+// catena di n if annidati nel ramo true (x<n ? (x<n-1 ? ... : n-1) : n)
+static void BM_DeepExpr(State& state) {
+  driver drv;
+  const int n = 100000;
+  symbol x = drv.intern("x");
+  ExprAST* E = new VariableExprAST(x);
+  for (int i = 0; i < n; i++)
+    E = new BinaryExprAST('+', new BinaryExprAST('*', E, new VariableExprAST(x)), new NumberExprAST(i));
+  codegen_expr(state, drv, E, 4 * n + 1);
+}
+BENCHMARK(BM_DeepExpr);
+
+static void BM_DeepIf(State& state) {
+  driver drv;
+  const int n = 100000;
+  symbol x = drv.intern("x");
+  ExprAST* E = new NumberExprAST(0);
+  for (int i = 1; i <= n; i++)
+    E = new IfExprAST(new BinaryExprAST('<', new VariableExprAST(x), new NumberExprAST(i)),
+                      E, new NumberExprAST(i));
+  codegen_expr(state, drv, E, 5 * n + 1);
+}
+BENCHMARK(BM_DeepIf);
+
+int main(int argc, char* argv[]) {
+  double mintime = 0.5;
+  std::vector<const char*> filters;
+  for (int i = 1; i < argc; i++)
+    if (!strcmp(argv[i], "-t") && i + 1 < argc)
+      mintime = atof(argv[++i]);
+    else
+      filters.push_back(argv[i]);
+
+  printf("%-16s %14s %12s %16s\n", "Benchmark", "Time (ns)", "Iterations", "Items/s");
+  for (auto& b : benchmarks()) {
+    bool selected = filters.empty();
+    for (const char* f : filters)
+      selected |= strstr(b.name, f) != nullptr;
+    if (!selected)
+      continue;
+    State state;
+    double secs = 0;
+    for (state.iterations = 1;; state.iterations *= 2) {
+      state.elapsed = 0;
+      b.body(state);
+      secs = state.elapsed;
+      if (secs >= mintime)
+        break;
+    }
+    printf("%-16s %14.0f %12llu %16.0f\n", b.name, secs * 1e9 / state.iterations,
+           (unsigned long long) state.iterations, state.items * state.iterations / secs);
+  }
+  return 0;
+}
@@ -1,11 +1,32 @@
 #include "driver.hpp"
 #include "parser.hpp"
-
-// Generazione di un'istanza per ciascuna della classi LLVMContext,
-// Module e IRBuilder. Nel caso di singolo modulo è sufficiente
-LLVMContext *context = new LLVMContext;
-Module *module = new Module("Kaleidoscope", *context);
-IRBuilder<> *builder = new IRBuilder(*context);
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Bitcode/BitcodeWriterPass.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/ProfileData/InstrProf.h"
+#include "llvm/ProfileData/ProfileCommon.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <sys/resource.h>
 
 Value *LogErrorV(const std::string Str) {
   std::cerr << Str << std::endl;
@@ -21,52 +42,718 @@ Value *LogErrorV(const std::string Str) {
    il nome passato come secondo parametro. L'istruzione verrà scritta all'inizio
    dell'entry block della funzione passata come primo parametro.
    Si ricordi che le istruzioni sono generate da un builder. Per non
-   interferire con il builder globale, la generazione viene dunque effettuata
+   interferire con il builder del driver, la generazione viene dunque effettuata
    con un builder temporaneo TmpB
 */
 static AllocaInst *CreateEntryBlockAlloca(Function *fun, StringRef VarName) {
   IRBuilder<> TmpB(&fun->getEntryBlock(), fun->getEntryBlock().begin());
-  return TmpB.CreateAlloca(Type::getDoubleTy(*context), nullptr, VarName);
+  return TmpB.CreateAlloca(Type::getDoubleTy(fun->getContext()), nullptr, VarName);
+}
+
+// Implementazione del costruttore della classe driver. Ogni driver possiede
+// la propria istanza di ciascuna delle classi LLVMContext, Module e IRBuilder:
+// driver distinti (uno per file) possono quindi lavorare su thread diversi
+driver::driver():
+  context(new LLVMContext), module(new Module("Kaleidoscope", *context)),
+  builder(new IRBuilder<>(*context)), out(&errs()),
+  trace_parsing(false), trace_scanning(false), optlevel(0), threads(1),
+  timing(false), pipeline(false), queue(nullptr), memo_size(1024), memo_evict(true), ParDepth(0),
+  Updating(nullptr), UpdateReads(0), SpawnPending(nullptr),
+  eval_steps(1000000), eval_fuel(10000000), EvalFuel(0), ItemCount(0), CurrentItem(0),
+  profile_generate(false), profile(nullptr), ProfSites(0),
+  ProfCounters(nullptr), ProfValues(nullptr) {};
+
+static OptimizationLevel opt_level(unsigned level) {
+  return level == 1 ? OptimizationLevel::O1 :
+         level == 2 ? OptimizationLevel::O2 : OptimizationLevel::O3;
+}
+
+// Pass builder e analysis manager, tutti legati al contesto LLVM del
+// driver che li usa: ogni driver (e quindi ogni thread) ha dunque i propri
+struct PassContext {
+  PassBuilder PB;
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  PassContext(TargetMachine* TM = nullptr): PB(TM) {
+    // Le funzioni di un programma K che hanno il nome di una funzione della
+    // libreria C (floor, sqrt, ...) sono funzioni K, con la propria semantica.
+    // Con le informazioni di libreria predefinite LLVM ne tratterebbe le
+    // chiamate come chiamate a libm: le valuterebbe con il risultato di libm
+    // o le sostituirebbe con intrinseci che l'output delle singole funzioni
+    // non dichiara. Tutte le funzioni di libreria vengono quindi disabilitate
+    TargetLibraryInfoImpl TLII;
+    TLII.disableAllFunctions();
+    FAM.registerPass([TLII] { return TargetLibraryAnalysis(TLII); });
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  }
+};
+
+// Le funzioni vengono ottimizzate una alla volta, subito dopo la generazione
+// del loro codice, con la pipeline di semplificazione di LLVM per il livello
+// richiesto
+struct FunctionOptimizer : PassContext {
+  FunctionPassManager FPM;
+
+  FunctionOptimizer(unsigned level) {
+    FPM = PB.buildFunctionSimplificationPipeline(opt_level(level), ThinOrFullLTOPhase::None);
+  }
+};
+
+driver::~driver() {};
+
+void driver::optimize(Function& F) {
+  if (!optlevel)
+    return;
+  if (!optimizer)
+    optimizer.reset(new FunctionOptimizer(optlevel));
+  optimizer->FPM.run(F, optimizer->FAM);
+  // I risultati delle analisi su F non servono più (e non devono essere
+  // riutilizzati se la funzione venisse rimossa e il suo indirizzo riciclato)
+  optimizer->FAM.clear(F, F.getName());
+}
+
+// La macchina target (quella nativa) serve per ottimizzare l'intero modulo
+// e per emettere codice oggetto. Alla prima richiesta viene creata e il
+// modulo riceve la corrispondente triple e il data layout
+TargetMachine* driver::target() {
+  if (TM)
+    return TM.get();
+  static std::once_flag init;
+  std::call_once(init, [] {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+  });
+  std::string triple = sys::getDefaultTargetTriple();
+  std::string err;
+  const Target *T = TargetRegistry::lookupTarget(triple, err);
+  if (!T) {
+    LogErrorV(err);
+    return nullptr;
+  }
+  TM.reset(T->createTargetMachine(triple, "generic", "", TargetOptions(), Reloc::PIC_));
+  module->setTargetTriple(triple);
+  module->setDataLayout(TM->createDataLayout());
+  return TM.get();
+}
+
+// Ottimizzazione dell'intero modulo con la pipeline standard di LLVM per il
+// livello richiesto, che comprende anche le ottimizzazioni interprocedurali
+// (inlining, IPSCCP, globalopt, ...): è usata quando il modulo contiene il
+// codice di più file (--whole-program). Con thinlto si usa invece la pipeline
+// che precede il link ThinLTO (-flto=thin), che rimanda al link l'inlining
+// fra moduli diversi
+void driver::optimize_module(unsigned level, bool thinlto) {
+  PhaseTimer T;
+  if (verifyModule(*module, &errs()))
+    return;
+  PassContext P(target());
+  ModulePassManager MPM;
+  if (thinlto)
+    MPM = level ? P.PB.buildThinLTOPreLinkDefaultPipeline(opt_level(level))
+                : P.PB.buildO0DefaultPipeline(OptimizationLevel::O0, true);
+  else if (level)
+    MPM = P.PB.buildPerModuleDefaultPipeline(opt_level(level));
+  MPM.run(*module, P.MAM);
+  Stats.optimize += T.lap();
+}
+
+// Emissione dell'intero modulo nel file outfile: codice oggetto se il
+// suffisso è .o, bitcode se è .bc, IR testuale altrimenti. Con summary il
+// bitcode contiene anche il riassunto del modulo (funzioni, chiamate,
+// riferimenti e, se c'è un profilo, la loro frequenza) usato dal link ThinLTO
+// per decidere quali funzioni importare dagli altri moduli
+int driver::emit(const std::string& outfile, bool summary) {
+  PhaseTimer T;
+  StringRef ext = sys::path::extension(outfile);
+  std::error_code EC;
+  raw_fd_ostream os(outfile, EC, ext == ".o" || ext == ".bc" ? sys::fs::OF_None : sys::fs::OF_Text);
+  if (EC) {
+    LogErrorV("cannot open " + outfile + ": " + EC.message());
+    return 1;
+  }
+  if (ext == ".o") {
+    legacy::PassManager PM;
+    if (!target() || target()->addPassesToEmitFile(PM, os, nullptr, CGFT_ObjectFile)) {
+      LogErrorV("Emissione di codice oggetto non supportata dal target");
+      return 1;
+    }
+    PM.run(*module);
+  } else if (ext == ".bc" && summary) {
+    PassContext P(target());
+    ModulePassManager MPM;
+    MPM.addPass(BitcodeWriterPass(os, false, true, true));
+    MPM.run(*module, P.MAM);
+  } else if (ext == ".bc") {
+    WriteBitcodeToFile(*module, os);
+  } else {
+    module->print(os, nullptr);
+  }
+  Stats.emit += T.lap();
+  return 0;
+}
+
+// Interning dei nomi. Lo scanner chiama intern per ogni identificatore:
+// la prima occorrenza di un nome gli assegna il primo id libero (e una
+// nuova posizione, inizialmente vuota, in ciascuna tabella dei simboli);
+// le occorrenze successive restituiscono lo stesso id senza allocare nulla.
+// Da qui in avanti (parser, AST, codegen) i nomi sono solo interi a 32 bit
+symbol driver::intern(StringRef Name) {
+  auto Ins = SymbolIds.try_emplace(Name, SymbolNames.size());
+  if (Ins.second) {
+    SymbolNames.push_back(Ins.first->getKey());
+    NamedValues.grow();
+    Functions.push_back(nullptr);
+    Defined.push_back(false);
+    Globals.push_back(nullptr);
+    PureDefs.push_back({nullptr, 0});
+  }
+  return Ins.first->second;
+}
+
+StringRef driver::name(symbol Sym) const {
+  return SymbolNames[Sym];
+}
+
+/************************* Compile statistics **************************/
+thread_local uint64_t RootAST::created = 0;
+
+PhaseTimer::PhaseTimer(): last(std::chrono::steady_clock::now()) {};
+
+double PhaseTimer::lap() {
+  auto now = std::chrono::steady_clock::now();
+  double secs = std::chrono::duration<double>(now - last).count();
+  last = now;
+  return secs;
+}
+
+// Con più file compilati in parallelo (-j) il picco è quello dell'intero
+// processo, e comprende quindi la memoria usata per gli altri file
+uint64_t CompileStats::peak_rss() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;  // Su macOS ru_maxrss è in byte
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+// Somma i tempi e i contatori di un driver di lavoro (il tempo totale,
+// che è un tempo reale, resta quello del driver principale)
+void CompileStats::merge(const CompileStats& other) {
+  scan += other.scan; parse += other.parse; irgen += other.irgen;
+  verify += other.verify; optimize += other.optimize; emit += other.emit;
+  tokens += other.tokens; astnodes += other.astnodes;
+  functions += other.functions; instructions += other.instructions;
+}
+
+// Restituisce n/t evitando divisioni per zero
+static double rate(uint64_t n, double t) {
+  return t > 0 ? n / t : 0;
 }
 
-// Implementazione del costruttore della classe driver
-driver::driver(): trace_parsing(false), trace_scanning(false) {};
+// Con la generazione parallela i tempi delle fasi sono sommati su tutti
+// i thread e possono quindi superare il tempo totale
+void CompileStats::print(raw_ostream& os, StringRef file) const {
+  std::pair<const char*, double> phases[] = {
+    {"scan", scan}, {"parse", parse}, {"irgen", irgen}, {"verify", verify},
+    {"optimize", optimize}, {"emit", emit}, {"totale", total}};
+  std::tuple<const char*, uint64_t, double> counters[] = {
+    {"token", tokens, rate(tokens, scan + parse)},
+    {"nodi AST", astnodes, rate(astnodes, parse)},
+    {"funzioni", functions, rate(functions, total)},
+    {"istruzioni IR", instructions, rate(instructions, irgen)}};
+  os << "===--- kcomp: tempi di compilazione di " << file << " ---===\n";
+  os << "  fase          tempo (s)        %\n";
+  for (auto& p : phases)
+    os << format("  %-10s %12.6f %7.1f%%\n", p.first, p.second,
+                 total > 0 ? 100 * p.second / total : 0.0);
+  os << "  contatore          totale     al secondo\n";
+  for (auto& c : counters)
+    os << format("  %-14s %12llu %14.0f\n", std::get<0>(c),
+                 (unsigned long long)std::get<1>(c), std::get<2>(c));
+  os << format("  picco memoria (KB): parse %llu, codegen %llu, totale %llu\n",
+               (unsigned long long)rss_parse, (unsigned long long)rss_codegen,
+               (unsigned long long)rss);
+}
+
+void CompileStats::print_json(raw_ostream& os, StringRef file) const {
+  os << "{\"file\": \"";
+  os.write_escaped(file);
+  os << "\", \"time\": {"
+     << format("\"scan\": %.6f, \"parse\": %.6f, \"irgen\": %.6f, ", scan, parse, irgen)
+     << format("\"verify\": %.6f, \"optimize\": %.6f, \"emit\": %.6f, ", verify, optimize, emit)
+     << format("\"total\": %.6f}, ", total)
+     << "\"count\": {\"tokens\": " << tokens << ", \"ast_nodes\": " << astnodes
+     << ", \"functions\": " << functions << ", \"ir_instructions\": " << instructions << "}, "
+     << format("\"rate\": {\"tokens_per_s\": %.0f, \"functions_per_s\": %.0f, ",
+               rate(tokens, scan + parse), rate(functions, total))
+     << format("\"ir_instructions_per_s\": %.0f}, ", rate(instructions, irgen))
+     << "\"peak_rss_kb\": {\"parse\": " << rss_parse << ", \"codegen\": " << rss_codegen
+     << ", \"total\": " << rss << "}}\n";
+}
+
+/************************* Scoped symbol table **************************/
+void ScopedSymbolTable::grow() {
+  Bindings.push_back(nullptr);
+}
+
+AllocaInst* ScopedSymbolTable::lookup(symbol Sym) const {
+  return Bindings[Sym];
+}
+
+void ScopedSymbolTable::bind(symbol Sym, AllocaInst* A) {
+  UndoLog.push_back({Sym, Bindings[Sym]});
+  Bindings[Sym] = A;
+}
+
+void ScopedSymbolTable::push_scope() {
+  Scopes.push_back(UndoLog.size());
+}
+
+// Ripristina, in ordine inverso, i valori sovrascritti nello scope che si
+// chiude: se un nome è stato legato più volte nello stesso scope, l'ultimo
+// ripristino è quello del valore esterno allo scope
+void ScopedSymbolTable::pop_scope() {
+  size_t mark = Scopes.back();
+  Scopes.pop_back();
+  while (UndoLog.size() > mark) {
+    Bindings[UndoLog.back().first] = UndoLog.back().second;
+    UndoLog.pop_back();
+  }
+}
+
+void ScopedSymbolTable::clear() {
+  while (!Scopes.empty())
+    pop_scope();
+}
+
+// I nomi legati sono tutti e soli quelli registrati nell'undo log
+std::vector<symbol> ScopedSymbolTable::visible() const {
+  std::vector<symbol> Names;
+  SmallDenseSet<symbol, 16> Seen;
+  for (auto& U : UndoLog)
+    if (Bindings[U.first] && Seen.insert(U.first).second)
+      Names.push_back(U.first);
+  return Names;
+}
 
 // Implementazione del metodo parse
+// Il codice degli elementi di primo livello viene generato durante il
+// parsing (si veda toplevel). Con la profilazione il codice delle funzioni fa
+// riferimento a metadati e contatori del modulo: le singole definizioni non
+// vengono quindi emesse e l'intero modulo viene stampato alla fine (codegen)
 int driver::parse (const std::string &f) {
+  raw_ostream* dest = out;
+  if (profiling()) {
+    out = nullptr;
+    if (profile && profile->Summary && !module->getProfileSummary(false))
+      module->setProfileSummary(profile->Summary->getMD(*context), ProfileSummary::PSK_Instr);
+  }
   file = f;                    // File con il programma
+  int res = pipeline ? parse_pipelined() : run_parser();
+  out = dest;
+  Stats.rss_parse = CompileStats::peak_rss();
+  return res;
+}
+
+// Scanning e parsing del file nel thread corrente
+int driver::run_parser () {
+  PhaseTimer T;
+  uint64_t nodes = RootAST::created;
+  double others = Stats.scan + Stats.irgen + Stats.verify + Stats.optimize + Stats.emit;
   location.initialize(&file);  // Inizializzazione dell'oggetto location
-  scan_begin();                // Inizio scanning (ovvero apertura del file programma)
-  yy::parser parser(*this);    // Istanziazione del parser
+  if (!scan_begin())           // Inizio scanning (ovvero apertura del file programma)
+    return 1;
+  yy::parser parser(*this, scanner); // Istanziazione del parser
   parser.set_debug_level(trace_parsing); // Livello di debug del parsed
   int res = parser.parse();    // Chiamata dell'entry point del parser
   scan_end();                  // Fine scanning (ovvero chiusura del file programma)
+  // Il tempo di parsing è quello complessivo al netto dello scanning e della
+  // generazione del codice
+  Stats.parse += T.lap() - (Stats.scan + Stats.irgen + Stats.verify + Stats.optimize +
+                            Stats.emit - others);
+  Stats.astnodes += RootAST::created - nodes;
+  return res;
+}
+
+/************************* Pipelined parsing **************************/
+// Coda senza lock a un produttore (il thread del parser) e un consumatore
+// (il thread che genera il codice). Il produttore scrive nella posizione
+// Tail % N e la pubblica incrementando Tail; il consumatore legge la
+// posizione Head % N e la restituisce incrementando Head. Con la coda piena
+// (o vuota) il thread cede il processore e riprova. Ogni messaggio porta,
+// oltre all'elemento di primo livello, i nomi internati dal parser dopo il
+// messaggio precedente, così che il consumatore possa internarli nello
+// stesso ordine (e quindi con gli stessi id) nel proprio driver
+struct PipelineQueue {
+  struct Message {
+    RootAST* item = nullptr;
+    std::vector<StringRef> names;
+    bool last = false;
+  };
+  static const size_t N = 1024;
+  Message Slots[N];
+  std::atomic<size_t> Head{0}, Tail{0};
+  size_t Shipped = 0;  // Nomi del parser già inviati (usato dal solo produttore)
+
+  void send(driver& fe, RootAST* item, bool last) {
+    Message m;
+    m.item = item;
+    m.last = last;
+    m.names.assign(fe.SymbolNames.begin() + Shipped, fe.SymbolNames.end());
+    Shipped = fe.SymbolNames.size();
+    size_t t = Tail.load(std::memory_order_relaxed);
+    while (t - Head.load(std::memory_order_acquire) == N)
+      std::this_thread::yield();
+    Slots[t % N] = std::move(m);
+    Tail.store(t + 1, std::memory_order_release);
+  }
+
+  Message receive() {
+    size_t h = Head.load(std::memory_order_relaxed);
+    while (Tail.load(std::memory_order_acquire) == h)
+      std::this_thread::yield();
+    Message m = std::move(Slots[h % N]);
+    Head.store(h + 1, std::memory_order_release);
+    return m;
+  }
+};
+
+// Parsing e generazione del codice in parallelo (-pipeline): un thread esegue
+// scanning e parsing con un driver di front-end, il cui toplevel accoda gli
+// elementi di primo livello, mentre il thread corrente li preleva e ne genera
+// il codice con questo driver. Le StringRef dei nomi puntano nella StringMap
+// del driver di front-end, che sopravvive al consumo di tutti i messaggi
+int driver::parse_pipelined () {
+  PipelineQueue Q;
+  driver fe;
+  fe.trace_parsing = trace_parsing;
+  fe.trace_scanning = trace_scanning;
+  fe.timing = timing;
+  fe.file = file;
+  fe.source = source;
+  for (StringRef name : SymbolNames)
+    fe.intern(name);
+  Q.Shipped = fe.SymbolNames.size();
+  fe.queue = &Q;
+
+  int res = 0;
+  std::thread parser([&] {
+    res = fe.run_parser();
+    Q.send(fe, nullptr, true);
+  });
+  for (;;) {
+    PipelineQueue::Message m = Q.receive();
+    for (StringRef name : m.names)
+      intern(name);
+    if (m.last)
+      break;
+    toplevel(m.item);
+  }
+  parser.join();
+  Stats.scan += fe.Stats.scan;
+  Stats.parse += fe.Stats.parse;
+  Stats.tokens += fe.Stats.tokens;
+  Stats.astnodes += fe.Stats.astnodes;
   return res;
 }
 
-// Implementazione del metodo codegen, che è una "semplice" chiamata del 
-// metodo omonimo presente nel nodo root (il puntatore root è stato scritto dal parser)
+// Analisi di un programma presente in memoria; name è usato nei messaggi
+// di errore come nome del file
+int driver::parse_string (StringRef text, const std::string& name) {
+  source = text.data() ? text : StringRef("");
+  int res = parse(name);
+  source = StringRef();
+  return res;
+}
+
+yy::parser::symbol_type yylex (driver& drv, void* yyscanner) {
+  drv.Stats.tokens++;
+  if (!drv.timing)
+    return yyscan(drv, yyscanner);
+  PhaseTimer T;
+  yy::parser::symbol_type tok = yyscan(drv, yyscanner);
+  drv.Stats.scan += T.lap();
+  return tok;
+}
+
+// Il parser chiama toplevel per ogni elemento di primo livello (definizione,
+// extern o globale) appena riconosciuto. Di norma il codice dell'elemento
+// viene generato ed emesso subito, dopo di che l'AST dell'elemento viene
+// liberato: la memoria usata per gli AST è quindi proporzionale alla
+// funzione più grande e non all'intero file. Con la generazione parallela
+// (-t) gli elementi vengono invece raccolti, nell'ordine del sorgente, per
+// essere distribuiti fra i thread da codegen; con -pipeline il driver di
+// front-end li passa al thread che genera il codice (parse_pipelined)
+void driver::toplevel(RootAST* item) {
+  if (!item)
+    return;
+  if (queue) {
+    queue->send(*this, item, false);
+    return;
+  }
+  CurrentItem = ItemCount++;
+  retain(item);
+  if (threads > 1 && !profiling()) {
+    Items.push_back(item);
+    return;
+  }
+  item->codegen(*this);
+  if (!retains(item))
+    delete item;
+}
+
+// Le definizioni pure (la prima, per ogni nome) vengono conservate, e
+// liberate soltanto con il driver, per la valutazione delle chiamate
+// a tempo di compilazione negli elementi successivi
+void driver::retain(RootAST* item) {
+  auto* F = dynamic_cast<FunctionAST*>(item);
+  if (!eval_steps || !F || !(F->getProto()->getAttrs() & PrototypeAST::Pure))
+    return;
+  PureDef& P = PureDefs[std::get<symbol>(F->getProto()->getLexVal())];
+  if (P.Def)
+    return;
+  P = {F, CurrentItem};
+  Retained.emplace_back(F);
+}
+
+bool driver::retains(RootAST* item) const {
+  auto* F = dynamic_cast<FunctionAST*>(item);
+  return F && PureDefs[std::get<symbol>(F->getProto()->getLexVal())].Def == F;
+}
+
+// Completa la generazione del codice iniziata durante il parsing: genera il
+// codice degli elementi eventualmente raccolti e, con la profilazione, emette
+// l'intero modulo (si veda parse)
 void driver::codegen() {
-  root->codegen(*this);
+  if (!Items.empty()) {
+    codegen_parallel();
+    for (RootAST* item : Items)
+      if (!retains(item))
+        delete item;
+    Items.clear();
+  }
+  if (profile_generate)
+    prof_register();
+  if (profiling() && out) {
+    PhaseTimer T;
+    module->print(*out, nullptr);
+    Stats.emit += T.lap();
+  } else if (out) {
+    emit_intrinsics();
+  }
+  Stats.rss_codegen = CompileStats::peak_rss();
 };
 
-/************************* Sequence tree **************************/
-SeqAST::SeqAST(RootAST* first, RootAST* continuation):
-  first(first), continuation(continuation) {};
+// Le singole definizioni vengono stampate senza le dichiarazioni degli
+// intrinseci LLVM che chiamano (funzioni predefinite, o intrinseci introdotti
+// dalle ottimizzazioni) e delle funzioni del supporto a tempo di esecuzione:
+// queste vengono emesse alla fine del file, in ordine di nome (l'ordine in
+// cui vengono dichiarate dipende, con -t, dai thread). Gli attributi degli
+// intrinseci non vengono stampati, perché sono fissati dall'intrinseco e
+// vengono ripristinati alla lettura dell'IR
+void driver::emit_intrinsics() {
+  std::vector<Function*> Decls;
+  for (Function& F : *module)
+    if (F.isIntrinsic() || (F.isDeclaration() && F.getName().startswith("__k")))
+      Decls.push_back(&F);
+  llvm::sort(Decls, [](Function* A, Function* B) { return A->getName() < B->getName(); });
+  for (Function* F : Decls) {
+    AttributeList Attrs = F->getAttributes();
+    F->setAttributes(AttributeList());
+    F->print(*out);
+    F->setAttributes(Attrs);
+  }
+}
 
-// La generazione del codice per una sequenza è banale:
-// mediante chiamate ricorsive viene generato il codice di first e 
-// poi quello di continuation (con gli opportuni controlli di "esistenza")
-Value *SeqAST::codegen(driver& drv) {
-  if (first != nullptr) {
-    Value *f = first->codegen(drv);
-  } else {
-    if (continuation == nullptr) return nullptr;
+// Funzioni del supporto a tempo di esecuzione (runtime/) chiamate dal codice
+// generato, dichiarate alla prima richiesta (nullptr se name non è una di
+// queste). I nomi iniziano con __k, che non può iniziare un nome K:
+//   __kpar_for(body, env, n)  esegue body(lo, hi, env) sugli intervalli di
+//                             [0, n) (kparallel.cpp)
+//   __kspawn(pending, fn, args, n, result)
+//                             genera il task fn(args, result), con una
+//                             copia degli n argomenti (ktask.cpp)
+//   __ksync(pending)          attende i task contati da pending (ktask.cpp)
+Function* driver::runtime(StringRef name) {
+  Type* Ptr = PointerType::getUnqual(builder->getDoubleTy());
+  Type* CountPtr = PointerType::getUnqual(builder->getInt64Ty());
+  FunctionType* FT = nullptr;
+  if (name == "__kpar_for") {
+    FunctionType* Body = FunctionType::get(builder->getVoidTy(),
+                                           {builder->getInt64Ty(), builder->getInt64Ty(), Ptr}, false);
+    FT = FunctionType::get(builder->getVoidTy(),
+                           {PointerType::getUnqual(Body), Ptr, builder->getInt64Ty()}, false);
+  } else if (name == "__kspawn") {
+    FunctionType* Fn = FunctionType::get(builder->getVoidTy(), {Ptr, Ptr}, false);
+    FT = FunctionType::get(builder->getVoidTy(),
+                           {CountPtr, PointerType::getUnqual(Fn), Ptr, builder->getInt64Ty(), Ptr}, false);
+  } else if (name == "__ksync") {
+    FT = FunctionType::get(builder->getVoidTy(), {CountPtr}, false);
   }
-  Value *c = continuation->codegen(drv);
-  return nullptr;
+  if (!FT)
+    return nullptr;
+  return cast<Function>(module->getOrInsertFunction(name, FT).getCallee());
+}
+
+// Dichiara nel modulo l'intrinseco (o la funzione del supporto) di nome name,
+// chiamato dal codice di un altro driver o da codice letto dalla cache. Gli
+// intrinseci sovraccaricati sono quelli sul tipo double, l'unico del linguaggio
+void driver::declare_intrinsic(StringRef name) {
+  if (runtime(name))
+    return;
+  Intrinsic::ID ID = Function::lookupIntrinsicID(name);
+  if (ID == Intrinsic::not_intrinsic || module->getFunction(name))
+    return;
+  SmallVector<Type*, 1> Tys;
+  if (Intrinsic::isOverloaded(ID))
+    Tys.push_back(builder->getDoubleTy());
+  if (Intrinsic::getName(ID, Tys, module.get(), nullptr) == name)
+    Intrinsic::getDeclaration(module.get(), ID, Tys);
+}
+
+// Prepara un driver "di lavoro" per la generazione parallela: i nomi internati
+// dal driver principale sono condivisi in sola lettura (le StringRef puntano
+// nella StringMap del driver principale, che sopravvive ai driver di lavoro)
+// mentre tutte le tabelle dei simboli (qui ancora vuote) sono proprie del
+// driver di lavoro. Vengono copiate anche le opzioni che influiscono sulla
+// generazione del codice
+void driver::import_symbols(const driver& parent) {
+  SymbolNames = parent.SymbolNames;
+  for (size_t i = 0; i < SymbolNames.size(); i++)
+    NamedValues.grow();
+  Functions.resize(SymbolNames.size(), nullptr);
+  Defined.resize(SymbolNames.size(), false);
+  Globals.resize(SymbolNames.size(), nullptr);
+  optlevel = parent.optlevel;
+  cachedir = parent.cachedir;
+  memo_size = parent.memo_size;
+  memo_evict = parent.memo_evict;
+  eval_steps = parent.eval_steps;
+  eval_fuel = parent.eval_fuel;
+  PureDefs = parent.PureDefs;
+}
+
+// Generazione del codice con più thread. Le definizioni di primo livello
+// vengono prima raccolte (nell'ordine del sorgente); ogni thread possiede un
+// driver di lavoro, con contesto e modulo propri. I thread si spartiscono
+// dinamicamente le funzioni, in ordine: prima di generare il codice di una
+// funzione il driver di lavoro dichiara i prototipi (di funzioni definite o
+// extern) e le variabili globali che la precedono nel sorgente, così che
+// siano visibili gli stessi nomi della compilazione sequenziale (un nome
+// definito più avanti è un errore anche qui). Per ciascuna generano il codice,
+// lo ottimizzano e lo stampano in un buffer riservato alla funzione, dopo di
+// che ne eliminano il corpo dal proprio modulo. Il codice di extern e
+// globali è prodotto dal driver principale. I buffer vengono infine emessi
+// nell'ordine del sorgente, per cui il risultato non dipende dai thread
+void driver::codegen_parallel() {
+  std::vector<RootAST*>& items = Items;
+  std::vector<std::string> text(items.size());
+
+  raw_ostream* dest = out;
+  std::vector<size_t> fundefs;
+  size_t first = ItemCount - items.size();  // Posizione del primo elemento
+  for (size_t i = 0; i < items.size(); i++)
+    if (dynamic_cast<FunctionAST*>(items[i])) {
+      fundefs.push_back(i);
+    } else {
+      raw_string_ostream os(text[i]);
+      out = &os;
+      CurrentItem = first + i;
+      items[i]->codegen(*this);
+      out = dest;
+    }
+
+  std::atomic<size_t> next(0);
+  std::mutex statslock;
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < std::min<size_t>(threads, fundefs.size()); t++)
+    pool.emplace_back([&] {
+      driver w;
+      w.import_symbols(*this);
+      size_t declared = 0;  // Elementi già dichiarati nel driver di lavoro
+      for (size_t k = next++; k < fundefs.size(); k = next++) {
+        w.out = nullptr;
+        for (; declared < fundefs[k]; declared++)
+          if (auto* F = dynamic_cast<FunctionAST*>(items[declared]))
+            F->getProto()->codegen(w);
+          else
+            items[declared]->codegen(w);
+        raw_string_ostream os(text[fundefs[k]]);
+        w.out = &os;
+        w.CurrentItem = first + fundefs[k];
+        static_cast<FunctionAST*>(items[fundefs[k]])->codegen(w);
+        declared = fundefs[k] + 1;
+      }
+      std::lock_guard<std::mutex> lock(statslock);
+      Stats.merge(w.Stats);
+      for (Function& F : *w.module)
+        if (F.isIntrinsic() || F.getName().startswith("__k"))
+          declare_intrinsic(F.getName());
+    });
+  for (auto& t : pool)
+    t.join();
+
+  PhaseTimer T;
+  for (auto& t : text)
+    *out << t;
+  Stats.emit += T.lap();
+}
+
+/****************** Generazione iterativa del codice ******************/
+// La generazione del codice di espressioni binarie, condizionali e blocchi
+// (e la loro distruzione) non usa lo stack del C++: espressioni annidate
+// per decine di migliaia di livelli (ad esempio lunghi polinomi) lo
+// esaurirebbero. emit_expr visita l'albero in post-ordine con uno stack
+// esplicito di EmitFrame: a ogni passo il nodo in cima allo stack (step)
+// restituisce il prossimo figlio di cui generare il codice, che viene
+// impilato, oppure termina consegnando il proprio valore al padre in ret.
+// Il codice emesso è lo stesso della visita ricorsiva
+struct EmitFrame {
+  ExprAST* node;
+  unsigned state = 0;         // Figli già visitati (il significato dipende dal nodo)
+  Value* val = nullptr;       // Valore di un figlio già generato
+  unsigned site = 0;          // Contatori del nodo (profilazione)
+  BasicBlock* TrueBB = nullptr;
+  BasicBlock* FalseBB = nullptr;
+  BasicBlock* MergeBB = nullptr;
+  Value* cond = nullptr;      // Condizione di un if tradotto in select
+  EmitFrame(ExprAST* node): node(node) {};
 };
 
+static Value* emit_expr(driver& drv, ExprAST* root) {
+  SmallVector<EmitFrame, 16> work;
+  work.emplace_back(root);
+  Value* ret = nullptr;
+  while (!work.empty())
+    if (ExprAST* next = work.back().node->step(drv, work.back(), ret))
+      work.emplace_back(next);
+    else
+      work.pop_back();
+  return ret;
+}
+
+// Allo stesso modo i sottoalberi vengono liberati staccando i figli di ogni
+// nodo (release) prima di distruggerlo
+static void delete_tree(RootAST* node) {
+  std::vector<RootAST*> Nodes;
+  node->release(Nodes);
+  while (!Nodes.empty()) {
+    RootAST* n = Nodes.back();
+    Nodes.pop_back();
+    n->release(Nodes);
+    delete n;
+  }
+}
+
 /********************* Number Expression Tree *********************/
 NumberExprAST::NumberExprAST(double Val): Val(Val) {};
 
@@ -81,11 +768,11 @@ lexval NumberExprAST::getLexVal() const {
 // La costante verrà utilizzata in altra parte del processo di generazione
 // Si noti che l'uso del contesto garantisce l'unicità della costanti 
 Value *NumberExprAST::codegen(driver& drv) {  
-  return ConstantFP::get(*context, APFloat(Val));
+  return ConstantFP::get(*drv.context, APFloat(Val));
 };
 
 /******************** Variable Expression Tree ********************/
-VariableExprAST::VariableExprAST(const std::string &Name): Name(Name) {};
+VariableExprAST::VariableExprAST(symbol Name): Name(Name) {};
 
 lexval VariableExprAST::getLexVal() const {
   lexval lval = Name;
@@ -103,70 +790,156 @@ lexval VariableExprAST::getLexVal() const {
 // l'istruzione ma è anche il registro, vista la corrispodenza 1-1 fra le due nozioni), (3)
 // il nome del registro in cui verrà trasferito il valore dalla memoria
 Value *VariableExprAST::codegen(driver& drv) {
-  AllocaInst* A = drv.NamedValues[Name];
+  AllocaInst* A = drv.NamedValues.lookup(Name);
 
   if(!A) {
     //Se A non è non è in NamedValues provo a cercarla nelle variabili globali.
-    GlobalVariable* G = module->getNamedGlobal(Name);
+    GlobalVariable* G = drv.Globals[Name];
 
     //Se non c'è nemmeno nei globali lancio errore.
-    if(!G) { return LogErrorV("Variabile "+Name+" not definita"); }
-    else { return builder->CreateLoad(G->getValueType(),G,Name.c_str());}
+    if(!G) { return LogErrorV("Variabile "+drv.name(Name).str()+" not definita"); }
+    else { return drv.builder->CreateLoad(G->getValueType(),G,drv.name(Name));}
 
   }
-  //Prende il valore della variabile Name da NamedValues
-  else { return builder->CreateLoad(A->getAllocatedType(),A,Name.c_str());}
+  //Prende il valore della variabile Name da NamedValues. Una variabile di
+  //riduzione può essere letta soltanto nel proprio aggiornamento
+  if (A == drv.Updating)
+    drv.UpdateReads++;
+  else
+    for (auto& R : drv.Reductions)
+      if (R.Acc == A) {
+        std::string s = drv.name(Name).str();
+        return LogErrorV("reduce: "+s+" può comparire soltanto in "+s+" = "+s+" "+R.Op+" espressione");
+      }
+  return drv.builder->CreateLoad(A->getAllocatedType(),A,drv.name(Name));
 }
 
 /******************** Binary Expression Tree **********************/
 BinaryExprAST::BinaryExprAST(char Op, ExprAST* LHS, ExprAST* RHS):
   Op(Op), LHS(LHS), RHS(RHS) {};
 
-// La generazione del codice in questo caso è di facile comprensione.
-// Vengono ricorsivamente generati il codice per il primo e quello per il secondo
-// operando. Con i valori memorizzati in altrettanti registri SSA si
-// costruisce l'istruzione utilizzando l'opportuno operatore
+BinaryExprAST::~BinaryExprAST() {
+  delete_tree(this);
+}
+
+void BinaryExprAST::release(std::vector<RootAST*>& Nodes) {
+  if (LHS) Nodes.push_back(LHS);
+  if (RHS) Nodes.push_back(RHS);
+  LHS = RHS = nullptr;
+}
+
 Value *BinaryExprAST::codegen(driver& drv) {
-  Value *L = LHS->codegen(drv);
-  Value *R = RHS->codegen(drv);
+  return emit_expr(drv, this);
+}
+
+// La generazione del codice in questo caso è di facile comprensione.
+// Vengono generati il codice per il primo e quello per il secondo
+// operando (come figli nello stack di emit_expr). Con i valori memorizzati
+// in altrettanti registri SSA si costruisce l'istruzione utilizzando
+// l'opportuno operatore
+ExprAST* BinaryExprAST::step(driver& drv, EmitFrame& F, Value*& ret) {
+  switch (F.state++) {
+  case 0:
+    return LHS;
+  case 1:
+    F.val = ret;
+    return RHS;
+  }
+  Value *L = F.val;
+  Value *R = ret;
+  ret = nullptr;
   if (!L || !R) 
      return nullptr;
   switch (Op) {
   case '+':
-    return builder->CreateFAdd(L,R,"addres");
+    ret = drv.builder->CreateFAdd(L,R,"addres");
+    break;
   case '-':
-    return builder->CreateFSub(L,R,"subres");
+    ret = drv.builder->CreateFSub(L,R,"subres");
+    break;
   case '*':
-    return builder->CreateFMul(L,R,"mulres");
+    ret = drv.builder->CreateFMul(L,R,"mulres");
+    break;
   case '/':
-    return builder->CreateFDiv(L,R,"addres");
+    ret = drv.builder->CreateFDiv(L,R,"addres");
+    break;
+  case '%':
+    ret = drv.builder->CreateFRem(L,R,"modres");
+    break;
   case '<':
-    return builder->CreateFCmpULT(L,R,"lttest");
+    ret = drv.builder->CreateFCmpULT(L,R,"lttest");
+    break;
   case '=':
-    return builder->CreateFCmpUEQ(L,R,"eqtest");
+    ret = drv.builder->CreateFCmpUEQ(L,R,"eqtest");
+    break;
   default:  
     std::cout << Op << std::endl;
-    return LogErrorV("Operatore binario non supportato");
+    ret = LogErrorV("Operatore binario non supportato");
   }
+  return nullptr;
 };
 
 /********************* Call Expression Tree ***********************/
 /* Call Expression Tree */
-CallExprAST::CallExprAST(std::string Callee, std::vector<ExprAST*> Args):
-  Callee(Callee),  Args(std::move(Args)) {};
+CallExprAST::CallExprAST(symbol Callee, std::vector<ExprAST*> Args):
+  Callee(Callee),  Args(std::move(Args)), Folded(0), Result(0) {};
+
+CallExprAST::~CallExprAST() {
+  for (auto arg : Args)
+    delete arg;
+}
 
 lexval CallExprAST::getLexVal() const {
   lexval lval = Callee;
   return lval;
 };
 
+// Funzioni matematiche predefinite. Una chiamata con il nome e il numero di
+// argomenti di una di queste diventa l'intrinseco LLVM corrispondente (per
+// fmod l'istruzione frem, come l'operatore %), che il back-end traduce in
+// genere in una singola istruzione e che il vettorizzatore sa trattare nei
+// cicli. La tabella viene consultata prima delle funzioni del modulo: una
+// funzione K con lo stesso nome resta definita (e chiamabile da C++), ma le
+// chiamate nei programmi K usano l'intrinseco
+static const struct {
+  StringLiteral Name;
+  unsigned Args;
+  Intrinsic::ID ID;
+} Builtins[] = {
+  {"floor", 1, Intrinsic::floor},
+  {"sqrt",  1, Intrinsic::sqrt},
+  {"fabs",  1, Intrinsic::fabs},
+  {"fmod",  2, Intrinsic::not_intrinsic},
+  {"pow",   2, Intrinsic::pow},
+};
+
 Value* CallExprAST::codegen(driver& drv) {
+  // Una chiamata valutata a tempo di compilazione è solo una costante
+  if (fold(drv))
+    return ConstantFP::get(*drv.context, APFloat(Result));
+
+  StringRef Name = drv.name(Callee);
+  for (auto& B : Builtins)
+    if (B.Name == Name && B.Args == Args.size()) {
+      std::vector<Value *> ArgsV;
+      for (auto arg : Args) {
+        ArgsV.push_back(arg->codegen(drv));
+        if (!ArgsV.back())
+          return nullptr;
+      }
+      if (B.ID == Intrinsic::not_intrinsic)
+        return drv.builder->CreateFRem(ArgsV[0], ArgsV[1], "modres");
+      return drv.builder->CreateIntrinsic(B.ID, {drv.builder->getDoubleTy()}, ArgsV,
+                                          nullptr, Name + "res");
+    }
+
   // La generazione del codice corrispondente ad una chiamata di funzione
-  // inizia cercando nel modulo corrente (l'unico, nel nostro caso) una funzione
-  // il cui nome coincide con il nome memorizzato nel nodo dell'AST
+  // inizia cercando nella tabella delle funzioni del driver (che contiene le
+  // funzioni del modulo corrente, l'unico nel nostro caso) quella il cui id
+  // coincide con l'id memorizzato nel nodo dell'AST
   // Se la funzione non viene trovata (e dunque non è stata precedentemente definita)
   // viene generato un errore
-  Function *CalleeF = module->getFunction(Callee);
+  Function *CalleeF = drv.Functions[Callee];
   if (!CalleeF)
      return LogErrorV("Funzione non definita");
   // Il secondo controllo è che la funzione recuperata abbia tanti parametri
@@ -186,47 +959,146 @@ Value* CallExprAST::codegen(driver& drv) {
      if (!ArgsV.back())
         return nullptr;
   }
-  return builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  // Con la profilazione si conta il numero di esecuzioni della chiamata
+  unsigned site = drv.prof_site();
+  drv.prof_count(site);
+  CallInst *Call = drv.builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  if (MDNode *W = drv.prof_weights({drv.prof_value(site)}))
+    Call->setMetadata(LLVMContext::MD_prof, W);
+  return Call;
 }
 
 /************************* If Expression Tree *************************/
 IfExprAST::IfExprAST(ExprAST* Cond, ExprAST* TrueExp, ExprAST* FalseExp):
    Cond(Cond), TrueExp(TrueExp), FalseExp(FalseExp) {};
-   
+
+IfExprAST::~IfExprAST() {
+  delete_tree(this);
+}
+
+void IfExprAST::release(std::vector<RootAST*>& Nodes) {
+  if (Cond) Nodes.push_back(Cond);
+  if (TrueExp) Nodes.push_back(TrueExp);
+  if (FalseExp) Nodes.push_back(FalseExp);
+  Cond = TrueExp = FalseExp = nullptr;
+}
+
 Value* IfExprAST::codegen(driver& drv) {
+  return emit_expr(drv, this);
+}
+
+// Rami senza salti. Se entrambi i rami sono espressioni brevi, senza
+// chiamate né assegnamenti, l'if viene tradotto valutandoli entrambi e
+// scegliendo il risultato con una select, che il back-end traduce in
+// genere in un'istruzione di spostamento condizionato: costa meno di un
+// salto che il processore non sa prevedere (come quello di err in sqrt.k,
+// nel ciclo più interno). Il limite è sul numero di nodi dei due rami
+static const unsigned MaxSelectNodes = 12;
+
+static bool take(unsigned& Budget) {
+  if (!Budget)
+    return false;
+  Budget--;
+  return true;
+}
+
+bool NumberExprAST::cheap(unsigned& Budget) const {
+  return take(Budget);
+}
+
+bool VariableExprAST::cheap(unsigned& Budget) const {
+  return take(Budget);
+}
+
+// frem diventa in genere una chiamata di fmod
+bool BinaryExprAST::cheap(unsigned& Budget) const {
+  return Op != '%' && take(Budget) && LHS->cheap(Budget) && RHS->cheap(Budget);
+}
+
+bool BooleanExprAST::cheap(unsigned& Budget) const {
+  return take(Budget) && LHS->cheap(Budget) && (!RHS || RHS->cheap(Budget));
+}
+
+bool IfExprAST::cheap(unsigned& Budget) const {
+  return take(Budget) && Cond->cheap(Budget) && TrueExp->cheap(Budget) &&
+         (!FalseExp || FalseExp->cheap(Budget));
+}
+
+// La generazione del codice procede in quattro passi, separati dalla
+// generazione del codice della condizione e dei due rami (si veda emit_expr).
+// Con la profilazione i due rami restano separati, per contarne le
+// esecuzioni (e, con -fprofile-use, decidere in base ai pesi dei salti)
+ExprAST* IfExprAST::step(driver& drv, EmitFrame& F, Value*& ret) {
+  Function *function = drv.builder->GetInsertBlock()->getParent();
+  switch (F.state++) {
+  case 0:
     // Viene dapprima generato il codice per valutare la condizione, che
     // memorizza il risultato (di tipo i1, dunque booleano) nel registro SSA 
     // che viene "memorizzato" in CondV. 
-    Value* CondV = Cond->codegen(drv);
+    return Cond;
+
+  case 1: {
+    Value* CondV = ret;
     if (!CondV)
        return nullptr;
+
+    unsigned Budget = MaxSelectNodes;
+    if (!drv.profiling() && TrueExp->cheap(Budget) && (!FalseExp || FalseExp->cheap(Budget))) {
+      F.cond = CondV;
+      F.state = 4;
+      return TrueExp;
+    }
     
     // Ora bisogna generare l'istruzione di salto condizionato, ma prima
     // vanno creati i corrispondenti basic block nella funzione attuale
     // (ovvero la funzione di cui fa parte il corrente blocco di inserimento)
-    Function *function = builder->GetInsertBlock()->getParent();
-    BasicBlock *TrueBB =  BasicBlock::Create(*context, "trueexp", function);
+    F.TrueBB =  BasicBlock::Create(*drv.context, "trueexp", function);
     // Il blocco TrueBB viene inserito nella funzione dopo il blocco corrente
-    BasicBlock *FalseBB = BasicBlock::Create(*context, "falseexp");
-    BasicBlock *MergeBB = BasicBlock::Create(*context, "endcond");
+    F.FalseBB = BasicBlock::Create(*drv.context, "falseexp");
+    F.MergeBB = BasicBlock::Create(*drv.context, "endcond");
     // Gli altri due blocchi non vengono ancora inseriti perché le istruzioni
     // previste nel "ramo" true del condizionale potrebbe dare luogo alla creazione
     // di altri blocchi, che naturalmente andrebbero inseriti prima di FalseBB
     
-    // Ora possiamo crere l'istruzione di salto condizionato
-    builder->CreateCondBr(CondV, TrueBB, FalseBB);
+    // Ora possiamo crere l'istruzione di salto condizionato. Con la
+    // profilazione si contano le esecuzioni dei due rami, che (con
+    // -fprofile-use) danno i pesi del salto
+    F.site = drv.prof_site(2);
+    drv.builder->CreateCondBr(CondV, F.TrueBB, F.FalseBB,
+                              drv.prof_weights({drv.prof_value(F.site), drv.prof_value(F.site+1)}));
     
     // "Posizioniamo" il builder all'inizio del blocco true, 
-    // generiamo ricorsivamente il codice da eseguire in caso di
-    // condizione vera e, in chiusura di blocco, generiamo il saldo 
+    // generiamo il codice da eseguire in caso di condizione vera e,
+    // in chiusura di blocco (al passo successivo), generiamo il saldo 
     // incondizionato al blocco merge
-    builder->SetInsertPoint(TrueBB);
-    Value *TrueV = TrueExp->codegen(drv);
-    if (!TrueV)
+    drv.builder->SetInsertPoint(F.TrueBB);
+    drv.prof_count(F.site);
+    return TrueExp;
+  }
+
+  // Traduzione con select: i rami sono generati di seguito, nel blocco
+  // corrente
+  case 4:
+    F.val = ret;
+    if (!F.val)
+       return nullptr;
+    if (FalseExp)
+      return FalseExp;
+    ret = ConstantFP::get(Type::getDoubleTy(*drv.context), 0.0);
+    [[fallthrough]];
+
+  case 5:
+    if (ret)
+      ret = drv.builder->CreateSelect(F.cond, F.val, ret, "condval");
+    return nullptr;
+
+  case 2:
+    F.val = ret;
+    if (!F.val)
        return nullptr;
-    builder->CreateBr(MergeBB);
+    drv.builder->CreateBr(F.MergeBB);
     
-    // Come già ricordato, la chiamata di codegen in TrueExp potrebbe aver inserito 
+    // Come già ricordato, la generazione del codice di TrueExp potrebbe aver inserito 
     // altri blocchi (nel caso in cui la parte trueexp sia a sua volta un condizionale).
     // Ne consegue che il blocco corrente potrebbe non coincidere più con TrueBB.
     // Il branch alla parte merge deve però essere effettuato dal blocco corrente,
@@ -234,53 +1106,69 @@ Value* IfExprAST::codegen(driver& drv) {
     // il salto perché tale informazione verrà utilizzata da un'istruzione PHI.
     // Nel caso in cui non sia stato inserito alcun nuovo blocco, la seguente
     // istruzione corrisponde ad una NO-OP
-    TrueBB = builder->GetInsertBlock();
-    function->insert(function->end(), FalseBB);
+    F.TrueBB = drv.builder->GetInsertBlock();
+    function->insert(function->end(), F.FalseBB);
     
     // "Posizioniamo" il builder all'inizio del blocco false, 
-    // generiamo ricorsivamente il codice da eseguire in caso di
-    // condizione falsa e, in chiusura di blocco, generiamo il saldo 
-    // incondizionato al blocco merge
-    builder->SetInsertPoint(FalseBB);
-    
-    Value *FalseV;
-    if (FalseExp) {
-        FalseV = FalseExp->codegen(drv);
-        if (!FalseV)
-            return nullptr;
-    } else {
-        // Se non c'è il ramo false, usare un valore predefinito
-        FalseV = ConstantFP::get(Type::getDoubleTy(*context), 0.0);
-    }
-    builder->CreateBr(MergeBB);
-    FalseBB = builder->GetInsertBlock();
+    // generiamo il codice da eseguire in caso di condizione falsa e,
+    // in chiusura di blocco, generiamo il saldo incondizionato al blocco merge
+    drv.builder->SetInsertPoint(F.FalseBB);
+    drv.prof_count(F.site+1);
+    if (FalseExp)
+        return FalseExp;
+    // Se non c'è il ramo false, usare un valore predefinito
+    ret = ConstantFP::get(Type::getDoubleTy(*drv.context), 0.0);
+  }
+
+  Value *TrueV = F.val;
+  Value *FalseV = ret;
+  if (!FalseV)
+      return nullptr;
+  drv.builder->CreateBr(F.MergeBB);
+  F.FalseBB = drv.builder->GetInsertBlock();
     
-    function->insert(function->end(), MergeBB);
+  function->insert(function->end(), F.MergeBB);
     
-    // Andiamo dunque a generare il codice per la parte dove i due "flussi"
-    // di esecuzione si riuniscono. Impostiamo correttamente il builder
-    builder->SetInsertPoint(MergeBB);
+  // Andiamo dunque a generare il codice per la parte dove i due "flussi"
+  // di esecuzione si riuniscono. Impostiamo correttamente il builder
+  drv.builder->SetInsertPoint(F.MergeBB);
   
-    // Il codice di riunione dei flussi è una "semplice" istruzione PHI: 
-    //a seconda del blocco da cui arriva il flusso, TrueBB o FalseBB, il valore
-    // del costrutto condizionale (si ricordi che si tratta di un "expression if")
-    // deve essere copiato (in un nuovo registro SSA) da TrueV o da FalseV
-    // La creazione di un'istruzione PHI avviene però in due passi, in quanto
-    // il numero di "flussi entranti" non è fissato.
-    // 1) Dapprima si crea il nodo PHI specificando quanti sono i possibili nodi sorgente
-    // 2) Per ogni possibile nodo sorgente, viene poi inserita l'etichetta e il registro
-    //    SSA da cui prelevare il valore 
-    PHINode *PN = builder->CreatePHI(Type::getDoubleTy(*context), 2, "condval");
-    PN->addIncoming(TrueV, TrueBB);
-    PN->addIncoming(FalseV, FalseBB);
-    return PN;
+  // Il codice di riunione dei flussi è una "semplice" istruzione PHI: 
+  //a seconda del blocco da cui arriva il flusso, TrueBB o FalseBB, il valore
+  // del costrutto condizionale (si ricordi che si tratta di un "expression if")
+  // deve essere copiato (in un nuovo registro SSA) da TrueV o da FalseV
+  // La creazione di un'istruzione PHI avviene però in due passi, in quanto
+  // il numero di "flussi entranti" non è fissato.
+  // 1) Dapprima si crea il nodo PHI specificando quanti sono i possibili nodi sorgente
+  // 2) Per ogni possibile nodo sorgente, viene poi inserita l'etichetta e il registro
+  //    SSA da cui prelevare il valore 
+  PHINode *PN = drv.builder->CreatePHI(Type::getDoubleTy(*drv.context), 2, "condval");
+  PN->addIncoming(TrueV, F.TrueBB);
+  PN->addIncoming(FalseV, F.FalseBB);
+  ret = PN;
+  return nullptr;
 };
 
 /********************** Block Expression Tree *********************/
 BlockExprAST::BlockExprAST(std::vector<VarBindingAST*> Def, std::vector<ExprAST*> Val): 
          Def(std::move(Def)), Val(std::move(Val)) {};
 
+BlockExprAST::~BlockExprAST() {
+  delete_tree(this);
+}
+
+void BlockExprAST::release(std::vector<RootAST*>& Nodes) {
+  Nodes.insert(Nodes.end(), Def.begin(), Def.end());
+  Nodes.insert(Nodes.end(), Val.begin(), Val.end());
+  Def.clear();
+  Val.clear();
+}
+
 Value* BlockExprAST::codegen(driver& drv) {
+  return emit_expr(drv, this);
+}
+
+ExprAST* BlockExprAST::step(driver& drv, EmitFrame& F, Value*& ret) {
    // Un blocco è un'espressione preceduta dalla definizione di una o più variabili locali.
    // Le definizioni sono opzionali e tuttavia necessarie perché l'uso di un blocco
    // abbia senso. Ad ogni variabile deve essere associato il valore di una costante o il valore di
@@ -301,45 +1189,48 @@ Value* BlockExprAST::codegen(driver& drv) {
    //    Questa deve essere inserita nella symbol table per futuri riferimenti ad y
    //    all'interno del blocco. Tuttavia, se un'istruzione alloca per y fosse già presente nella symbol
    //    table (nel caso y sia un parametro) bisognerebbe "rimuoverla" temporaneamente e re-inserirla
-   //    all'uscita del blocco. Questo è ciò che viene fatto dal presente codice, che utilizza
-   //    al riguardo il vettore di appoggio "AllocaTmp" (che naturalmente è un vettore di
-   //    di (puntatori ad) istruzioni di allocazione
-   std::vector<AllocaInst*> AllocaTmp;
-   for (int i=0, e=Def.size(); i<e; i++) {
-      // Per ogni definizione di variabile si genera il corrispondente codice che
-      // (in questo caso) non restituisce un registro SSA ma l'istruzione di allocazione
-      AllocaInst *boundval = Def[i]->codegen(drv);
-      if (!boundval) 
-         return nullptr;
-      // Viene temporaneamente rimossa la precedente istruzione di allocazione
-      // della stessa variabile (nome) e inserita quella corrente
-      AllocaTmp.push_back(drv.NamedValues[Def[i]->getName()]);
-      drv.NamedValues[Def[i]->getName()] = boundval;
-   };
-   // Ora (ed è la parte più "facile" da capire) viene generato il codice che
-   // valuta l'espressione. Eventuali riferimenti a variabili vengono risolti
-   // nella symbol table appena modificata
-   Value *blockvalue;
-   for (int i = 0, e=Val.size(); i<e; i++) {
-       blockvalue = Val[i]->codegen(drv);
-      if (!blockvalue)
-         return nullptr;
+   //    all'uscita del blocco. Questo è ciò che fa la symbol table del driver: il blocco apre
+   //    un nuovo scope, vi lega le proprie variabili e lo chiude in uscita, ripristinando
+   //    così le associazioni esterne
+   if (F.state == 0) {
+      drv.NamedValues.push_scope();
+      for (int i=0, e=Def.size(); i<e; i++) {
+         // Per ogni definizione di variabile si genera il corrispondente codice che
+         // (in questo caso) non restituisce un registro SSA ma l'istruzione di allocazione
+         AllocaInst *boundval = Def[i]->codegen(drv);
+         if (!boundval) {
+            ret = nullptr;
+            return nullptr;
+         }
+         // L'istruzione di allocazione corrente "nasconde", fino alla chiusura
+         // dello scope, quella della variabile esterna con lo stesso nome
+         drv.NamedValues.bind(Def[i]->getName(), boundval);
+      };
    }
+   // Ora (ed è la parte più "facile" da capire) viene generato il codice che
+   // valuta le espressioni, una per passo. Eventuali riferimenti a variabili
+   // vengono risolti nella symbol table appena modificata
+   if (F.state > 0 && !ret)
+      return nullptr;
+   if (F.state < Val.size())
+      return Val[F.state++];
    
    // Prima di uscire dal blocco, si ripristina lo scope esterno al costrutto
-   for (int i=0, e=Def.size(); i<e; i++) {
-        drv.NamedValues[Def[i]->getName()] = AllocaTmp[i];
-   };
+   drv.NamedValues.pop_scope();
    // Il valore del costrutto/espressione var è ovviamente il valore (il registro SSA)
-   // restituito dal codice di valutazione dell'espressione
-   return blockvalue;
+   // restituito dal codice di valutazione dell'ultima espressione (in ret)
+   return nullptr;
 };
 
 /************************* Var binding Tree *************************/
-VarBindingAST::VarBindingAST(const std::string Name, ExprAST* Val):
+VarBindingAST::VarBindingAST(symbol Name, ExprAST* Val):
    Name(Name), Val(Val) {};
+
+VarBindingAST::~VarBindingAST() {
+  delete Val;
+}
    
-const std::string& VarBindingAST::getName() const { 
+symbol VarBindingAST::getName() const { 
    return Name; 
 };
 
@@ -350,16 +1241,16 @@ AllocaInst* VarBindingAST::codegen(driver& drv) {
    // di un parametro oppure di una variabile locale ad un blocco espressione)
    // viene sempre riservato nell'entry block della funzione. Ricordiamo che
    // l'allocazione viene fatta tramite l'utility CreateEntryBlockAlloca
-   Function *fun = builder->GetInsertBlock()->getParent();
+   Function *fun = drv.builder->GetInsertBlock()->getParent();
    // Ora viene generato il codice che definisce il valore della variabile
    Value *BoundVal = Val->codegen(drv);
    if (!BoundVal)  // Qualcosa è andato storto nella generazione del codice?
       return nullptr;
    // Se tutto ok, si genera l'struzione che alloca memoria per la varibile ...
-   AllocaInst *Alloca = CreateEntryBlockAlloca(fun, Name);
+   AllocaInst *Alloca = CreateEntryBlockAlloca(fun, drv.name(Name));
    // ... e si genera l'istruzione per memorizzarvi il valore dell'espressione,
    // ovvero il contenuto del registro BoundVal
-   builder->CreateStore(BoundVal, Alloca);
+   drv.builder->CreateStore(BoundVal, Alloca);
    
    // L'istruzione di allocazione (che include il registro "puntatore" all'area di memoria
    // allocata) viene restituita per essere inserita nella symbol table
@@ -367,15 +1258,15 @@ AllocaInst* VarBindingAST::codegen(driver& drv) {
 };
 
 /************************* Prototype Tree *************************/
-PrototypeAST::PrototypeAST(std::string Name, std::vector<std::string> Args):
-  Name(Name), Args(std::move(Args)), emitcode(true) {};  //Di regola il codice viene emesso
+PrototypeAST::PrototypeAST(symbol Name, std::vector<symbol> Args):
+  Name(Name), Args(std::move(Args)), emitcode(true), Attrs(0) {};  //Di regola il codice viene emesso
 
 lexval PrototypeAST::getLexVal() const {
    lexval lval = Name;
    return lval;	
 };
 
-const std::vector<std::string>& PrototypeAST::getArgs() const { 
+const std::vector<symbol>& PrototypeAST::getArgs() const { 
    return Args;
 };
 
@@ -384,27 +1275,115 @@ void PrototypeAST::noemit() {
    emitcode = false; 
 };
 
+void PrototypeAST::setAttrs(unsigned A) {
+   Attrs |= A;
+};
+
+unsigned PrototypeAST::getAttrs() const {
+   return Attrs;
+};
+
+// Attributi delle funzioni annotate. Una funzione pure non accede alla
+// memoria (il risultato dipende soltanto dagli argomenti), non solleva
+// eccezioni e termina sempre: le sue chiamate possono quindi essere
+// eliminate, unificate e spostate fuori dai cicli. Una funzione memo def,
+// che è anche pure, scrive però nelle proprie tabelle e non può dunque
+// dichiarare di non accedere alla memoria. Una funzione inline viene
+// sempre espansa nei chiamanti
+static void set_attributes(Function *F, unsigned Attrs) {
+  if (Attrs & PrototypeAST::Pure) {
+    if (!(Attrs & PrototypeAST::Memo))
+      F->setDoesNotAccessMemory();
+    F->setDoesNotThrow();
+    F->addFnAttr(Attribute::WillReturn);
+  }
+  if (Attrs & PrototypeAST::Inline)
+    F->addFnAttr(Attribute::AlwaysInline);
+}
+
+// Stampa F su os. Stampata da sola, una funzione fa riferimento ai gruppi di
+// attributi del modulo (#N), che però non vengono emessi: i riferimenti
+// vengono quindi sostituiti dagli attributi stessi, nell'ordine in cui
+// compaiono (quelli della funzione e poi quelli delle chiamate)
+static void print_function(Function &F, raw_ostream &os) {
+  std::vector<AttributeSet> Sets;
+  if (F.getAttributes().hasFnAttrs())
+    Sets.push_back(F.getAttributes().getFnAttrs());
+  for (BasicBlock &BB : F)
+    for (Instruction &I : BB)
+      if (auto *Call = dyn_cast<CallBase>(&I))
+        if (Call->getAttributes().hasFnAttrs())
+          Sets.push_back(Call->getAttributes().getFnAttrs());
+  if (Sets.empty()) {
+    F.print(os);
+    return;
+  }
+  std::string text;
+  raw_string_ostream ts(text);
+  F.print(ts);
+  ts.flush();
+  StringRef rest(text);
+  size_t k = 0;
+  for (size_t pos; (pos = rest.find(" #")) != StringRef::npos; ) {
+    os << rest.take_front(pos);
+    rest = rest.drop_front(pos + 2);
+    size_t digits = rest.find_first_not_of("0123456789");
+    if (digits == 0 || k == Sets.size()) {
+      os << " #";
+      continue;
+    }
+    os << ' ' << Sets[k++].getAsString();
+    rest = rest.drop_front(std::min(digits, rest.size()));
+  }
+  os << rest;
+}
+
+// Elimina le funzioni estratte dalla funzione corrente. I riferimenti sono
+// rimossi prima, perché il corpo di un parfor chiama quello dei parfor
+// annidati, che in Outlined lo precedono
+static void erase_outlined(driver& drv) {
+  for (Function* F : drv.Outlined)
+    F->dropAllReferences();
+  for (Function* F : drv.Outlined)
+    F->eraseFromParent();
+  drv.Outlined.clear();
+}
+
 Function *PrototypeAST::codegen(driver& drv) {
+  // Se la funzione è già stata dichiarata (ad esempio da un extern che
+  // precede la definizione) si riutilizza la dichiarazione esistente, che
+  // deve però avere lo stesso numero di parametri
+  if (Function *F = drv.Functions[Name]) {
+    if (F->arg_size() != Args.size()) {
+      LogErrorV("Funzione "+drv.name(Name).str()+" dichiarata con un numero diverso di argomenti");
+      return nullptr;
+    }
+    set_attributes(F, Attrs);
+    return F;
+  }
+
   // Costruisce una struttura, qui chiamata FT, che rappresenta il "tipo" di una
   // funzione. Con ciò si intende a sua volta una coppia composta dal tipo
   // del risultato (valore di ritorno) e da un vettore che contiene il tipo di tutti
   // i parametri. Si ricordi, tuttavia, che nel nostro caso l'unico tipo è double.
   
   // Prima definiamo il vettore (qui chiamato Doubles) con il tipo degli argomenti
-  std::vector<Type*> Doubles(Args.size(), Type::getDoubleTy(*context));
+  std::vector<Type*> Doubles(Args.size(), Type::getDoubleTy(*drv.context));
   // Quindi definiamo il tipo (FT) della funzione
-  FunctionType *FT = FunctionType::get(Type::getDoubleTy(*context), Doubles, false);
+  FunctionType *FT = FunctionType::get(Type::getDoubleTy(*drv.context), Doubles, false);
   // Infine definiamo una funzione (al momento senza body) del tipo creato e con il nome
   // presente nel nodo AST. ExternalLinkage vuol dire che la funzione può avere
   // visibilità anche al di fuori del modulo
-  Function *F = Function::Create(FT, Function::ExternalLinkage, Name, *module);
+  Function *F = Function::Create(FT, Function::ExternalLinkage, drv.name(Name), *drv.module);
+  drv.Functions[Name] = F;
+  set_attributes(F, Attrs);
 
   // Ad ogni parametro della funzione F (che, è bene ricordare, è la rappresentazione 
   // llvm di una funzione, non è una funzione C++) attribuiamo ora il nome specificato dal
   // programmatore e presente nel nodo AST relativo al prototipo
   unsigned Idx = 0;
   for (auto &Arg : F->args())
-    Arg.setName(Args[Idx++]);
+    Arg.setName(drv.name(Args[Idx++]));
 
   /* Abbiamo completato la creazione del codice del prototipo.
      Il codice può quindi essere emesso, ma solo se esso corrisponde
@@ -415,9 +1394,9 @@ Function *PrototypeAST::codegen(driver& drv) {
      (come nel caso di funzione esterna) sia una definizione della stessa
      funzione.
   */
-  if (emitcode) {
-    F->print(errs());
-    fprintf(stderr, "\n");
+  if (emitcode && drv.out) {
+    print_function(*F, *drv.out);
+    *drv.out << "\n";
   };
   
   return F;
@@ -426,24 +1405,71 @@ Function *PrototypeAST::codegen(driver& drv) {
 /************************* Function Tree **************************/
 FunctionAST::FunctionAST(PrototypeAST* Proto, ExprAST* Body): Proto(Proto), Body(Body) {};
 
+FunctionAST::~FunctionAST() {
+  delete Proto;
+  delete Body;
+}
+
+PrototypeAST* FunctionAST::getProto() const {
+  return Proto;
+};
+
 Function *FunctionAST::codegen(driver& drv) {
-  // Verifica che la funzione non sia già presente nel modulo, cioò che non
-  // si tenti una "doppia definizion"
-  Function *function = 
-      module->getFunction(std::get<std::string>(Proto->getLexVal()));
-  // Se la funzione non è già presente, si prova a definirla, innanzitutto
-  // generando (ma non emettendo) il codice del prototipo
-  if (!function)
-    function = Proto->codegen(drv);
-  else
+  PhaseTimer T;
+  // Verifica che la funzione non sia già definita nel modulo, cioè che non
+  // si tenti una "doppia definizione". Una funzione soltanto dichiarata
+  // (extern, oppure predichiarata dalla generazione parallela) può invece
+  // essere definita
+  symbol Name = std::get<symbol>(Proto->getLexVal());
+  Function *function = drv.Functions[Name];
+  if (drv.Defined[Name] || (function && !function->empty())) {
+    LogErrorV("Funzione "+drv.name(Name).str()+" già definita");
     return nullptr;
+  }
+  bool declared = function != nullptr;
+  // Si genera (ma non si emette) il codice del prototipo, che per una
+  // funzione già dichiarata restituisce la dichiarazione esistente
+  function = Proto->codegen(drv);
   // Se, per qualche ragione, la definizione "fallisce" si restituisce nullptr
   if (!function)
     return nullptr;  
+  // I parametri prendono i nomi usati nella definizione
+  if (declared) {
+    unsigned Idx = 0;
+    for (auto &Arg : function->args())
+      Arg.setName(drv.name(Proto->getArgs()[Idx++]));
+  }
+
+  // Passi concessi alla valutazione delle chiamate nel corpo (anche durante
+  // il calcolo dell'impronta, che ne include i valori)
+  drv.EvalFuel = drv.eval_fuel;
+
+  // Se la cache è attiva e contiene il codice (già ottimizzato) di una
+  // funzione con la stessa impronta, questo viene emesso così com'è e nel
+  // modulo la funzione resta soltanto dichiarata
+  std::string key;
+  if (!drv.cachedir.empty() && !drv.profiling()) {
+    key = drv.cache_key(*this);
+    std::string text;
+    if (drv.cache_lookup(key, text)) {
+      *drv.out << text;
+      StringRef rest(text);
+      for (size_t pos; (pos = rest.find('@')) != StringRef::npos; ) {
+        rest = rest.drop_front(pos + 1);
+        if (rest.startswith("llvm.") || rest.startswith("__k"))
+          drv.declare_intrinsic(rest.take_while([](char c) {
+            return isAlnum(c) || c == '.' || c == '_';
+          }));
+      }
+      drv.Defined[Name] = true;
+      return function;
+    }
+  }
 
   // Altrimenti si crea un blocco di base in cui iniziare a inserire il codice
-  BasicBlock *BB = BasicBlock::Create(*context, "entry", function);
-  builder->SetInsertPoint(BB);
+  BasicBlock *BB = BasicBlock::Create(*drv.context, "entry", function);
+  drv.builder->SetInsertPoint(BB);
+  drv.prof_begin(function);
  
   // Ora viene la parte "più delicata". Per ogni parametro formale della
   // funzione, nella symbol table si registra una coppia in cui la chiave
@@ -458,73 +1484,220 @@ Function *FunctionAST::codegen(driver& drv) {
   // perché esso è parte della rappresentazione C++ dell'istruzione di allocazione
   // (variabile Alloca) 
   
+  // I parametri vivono in uno scope proprio della funzione, chiuso al termine
+  // della generazione del codice (anche in caso di errore, insieme agli
+  // eventuali scope interni rimasti aperti)
+  drv.NamedValues.push_scope();
+  unsigned Idx = 0;
   for (auto &Arg : function->args()) {
     // Genera l'istruzione di allocazione per il parametro corrente
     AllocaInst *Alloca = CreateEntryBlockAlloca(function, Arg.getName());
     // Genera un'istruzione per la memorizzazione del parametro nell'area
     // di memoria allocata
-    builder->CreateStore(&Arg, Alloca);
+    drv.builder->CreateStore(&Arg, Alloca);
     // Registra gli argomenti nella symbol table per eventuale riferimento futuro
-    drv.NamedValues[std::string(Arg.getName())] = Alloca;
+    drv.NamedValues.bind(Proto->getArgs()[Idx++], Alloca);
   } 
+
+  // Per una funzione memo def, la ricerca del risultato nella tabella
+  drv.MemoGlobals.clear();
+  drv.Outlined.clear();
+  drv.Reductions.clear();
+  drv.SpawnPending = nullptr;
+  if (Proto->getAttrs() & PrototypeAST::Memo)
+    drv.memo_begin(function);
   
   // Ora può essere generato il codice corssipondente al body (che potrà
   // fare riferimento alla symbol table)
   if (Value *RetVal = Body->codegen(drv)) {
     // Se la generazione termina senza errori, ciò che rimane da fare è
     // di generare l'istruzione return, che ("a tempo di esecuzione") prenderà
-    // il valore lasciato nel registro RetVal 
-    builder->CreateRet(RetVal);
+    // il valore lasciato nel registro RetVal (dopo averlo memorizzato
+    // nella tabella di una funzione memo def). Una funzione che genera task
+    // li attende prima di terminare, dato che i loro risultati sono scritti
+    // nelle sue variabili
+    if (drv.SpawnPending)
+      drv.builder->CreateCall(drv.runtime("__ksync"), {drv.SpawnPending});
+    if (!drv.MemoGlobals.empty())
+      drv.memo_end(RetVal);
+    drv.builder->CreateRet(RetVal);
+
+    drv.NamedValues.clear();
+    drv.prof_end(function, true);
+    drv.Stats.functions++;
+    drv.Stats.instructions += function->getInstructionCount();
+    for (Function* F : drv.Outlined)
+      drv.Stats.instructions += F->getInstructionCount();
+    drv.Stats.irgen += T.lap();
 
     // Effettua la validazione del codice e un controllo di consistenza
+    // (anche dei corpi dei parfor e dei task di spawn, estratti in funzioni
+    // proprie)
     verifyFunction(*function);
+    for (Function* F : drv.Outlined)
+      verifyFunction(*F);
+    drv.Stats.verify += T.lap();
+
+    // Ottimizzazione (se richiesta con -O1, -O2 o -O3)
+    drv.optimize(*function);
+    for (Function* F : drv.Outlined)
+      drv.optimize(*F);
+    drv.Stats.optimize += T.lap();
  
-    // Emissione del codice su su stderr) 
-    function->print(errs());
-    fprintf(stderr, "\n");
+    // Emissione del codice (di default su stderr), che viene anche
+    // memorizzato nella cache se attiva
+    if (key.empty()) {
+      if (drv.out) {
+        drv.memo_print(*drv.out);
+        print_function(*function, *drv.out);
+        *drv.out << "\n";
+        for (Function* F : drv.Outlined) {
+          print_function(*F, *drv.out);
+          *drv.out << "\n";
+        }
+      }
+    } else {
+      std::string text;
+      raw_string_ostream os(text);
+      drv.memo_print(os);
+      print_function(*function, os);
+      os << "\n";
+      for (Function* F : drv.Outlined) {
+        print_function(*F, os);
+        os << "\n";
+      }
+      os.flush();
+      *drv.out << text;
+      drv.cache_store(key, text);
+    }
+    drv.Stats.emit += T.lap();
+    // Il codice emesso non serve più: nel modulo la funzione resta soltanto
+    // dichiarata, così che la memoria usata non cresca con il numero delle
+    // funzioni. Il modulo completo serve invece quando non si emettono le
+    // singole definizioni (--whole-program, -flto=thin, profilazione)
+    drv.Defined[Name] = true;
+    if (drv.out) {
+      function->deleteBody();
+      erase_outlined(drv);
+    }
+    drv.Outlined.clear();
     return function;
   }
 
-  // Errore nella definizione. La funzione viene rimossa
-  function->eraseFromParent();
+  // Errore nella definizione. La funzione viene rimossa (o, se era già
+  // dichiarata, riportata allo stato di dichiarazione). Le funzioni estratte
+  // possono chiamarla (uno spawn ricorsivo, ad esempio), per cui vengono
+  // eliminate dopo il suo corpo ma prima della funzione stessa
+  drv.NamedValues.clear();
+  function->deleteBody();
+  erase_outlined(drv);
+  if (!declared) {
+    function->eraseFromParent();
+    drv.Functions[Name] = nullptr;
+  }
+  drv.memo_discard();
+  drv.prof_end(function, false);
   return nullptr;
 };
 
 /*****************************+*********+*/
 
 /*********************** Global AST ***********************/
-GlobalAST::GlobalAST(std::string Name): Name(Name) {};
+GlobalAST::GlobalAST(symbol Name, bool ThreadLocal): Name(Name), ThreadLocal(ThreadLocal) {};
 
+// Una globale threadlocal ha una copia per thread. Il modello initial-exec
+// accede alla copia con un offset fisso dal puntatore del thread, senza
+// chiamate a __tls_get_addr: è quello adatto al link statico (o nel
+// programma principale), mentre non lo è per una libreria caricata con dlopen
 Value* GlobalAST::codegen(driver &drv) {
 
-  GlobalVariable *gVar = new GlobalVariable(*module, Type::getDoubleTy(*context), false, GlobalValue::CommonLinkage, ConstantFP::get(*context, APFloat(0.0)) , Name);
+  GlobalVariable *gVar = new GlobalVariable(*drv.module, Type::getDoubleTy(*drv.context), false, GlobalValue::CommonLinkage, ConstantFP::get(*drv.context, APFloat(0.0)) , drv.name(Name));
+  if (ThreadLocal)
+    gVar->setThreadLocalMode(GlobalValue::InitialExecTLSModel);
+  drv.Globals[Name] = gVar;
 
-  gVar->print(errs());
-  fprintf(stderr, "\n");
+  if (drv.out) {
+    gVar->print(*drv.out);
+    *drv.out << "\n";
+  }
   return gVar;
 };
 
 
 /*********************** Assignment Expression Tree ***********************/
-AssignmentExprAST::AssignmentExprAST(std::string Name, ExprAST* Val): Name(Name), Val(Val) {};
+// Un aggiornamento di una variabile di riduzione deve avere la forma
+// s = s op e1 op e2 ...: V è una catena di operazioni op in cui compare il
+// valore corrente di s (letto dall'accumulatore), che l'espressione legge
+// una sola volta (lo verifica il chiamante, contando le letture). Alle
+// operazioni della catena, e soltanto a queste, è concesso di riassociare
+// gli operandi, così che LLVM possa dividere l'accumulazione in parziali
+static bool reduction_update(Value* V, const driver::Reduction& R) {
+  unsigned Opcode = R.Op == '+' ? Instruction::FAdd : Instruction::FMul;
+  SmallVector<BinaryOperator*, 8> Chain;
+  SmallVector<Value*, 8> Work{V};
+  unsigned uses = 0;
+  while (!Work.empty()) {
+    Value* X = Work.pop_back_val();
+    if (auto* I = dyn_cast<BinaryOperator>(X); I && I->getOpcode() == Opcode) {
+      Chain.push_back(I);
+      Work.append({I->getOperand(0), I->getOperand(1)});
+    } else if (auto* L = dyn_cast<LoadInst>(X)) {
+      uses += L->getPointerOperand() == R.Acc;
+    }
+  }
+  if (uses != 1)
+    return false;
+  for (BinaryOperator* I : Chain)
+    I->setHasAllowReassoc(true);
+  return true;
+}
+
+AssignmentExprAST::AssignmentExprAST(symbol Name, ExprAST* Val): Name(Name), Val(Val) {};
+
+AssignmentExprAST::~AssignmentExprAST() {
+  delete Val;
+}
 
 Value* AssignmentExprAST::codegen(driver& drv) {
 
+  AllocaInst* A = drv.NamedValues.lookup(Name);
+
+  //Nell'aggiornamento di una variabile di riduzione se ne contano le letture
+  const driver::Reduction* R = nullptr;
+  for (auto& X : drv.Reductions)
+    if (X.Acc == A)
+      R = &X;
+  drv.Updating = R ? A : nullptr;
+  drv.UpdateReads = 0;
   Value* V = Val->codegen(drv);
+  drv.Updating = nullptr;
 
   if(!V) {return nullptr;}
 
-  AllocaInst* A = drv.NamedValues[Name];
+  if (R && (drv.UpdateReads != 1 || !reduction_update(V, *R))) {
+    std::string s = drv.name(Name).str();
+    return LogErrorV("reduce: "+s+" va aggiornata con "+s+" = "+s+" "+R->Op+" espressione");
+  }
+
+  //Nel corpo di un parfor le variabili del chiamante sono copie private:
+  //assegnarle è un errore. Una globale è invece condivisa fra le iterazioni,
+  //che non sono quindi più indipendenti (se threadlocal, è condivisa solo
+  //da quelle eseguite dallo stesso thread, per cui non ci sono corse)
+  if(A && std::find(drv.ParShared.begin(), drv.ParShared.end(), A) != drv.ParShared.end())
+    return LogErrorV("parfor: il corpo non può assegnare la variabile "+drv.name(Name).str()+" del chiamante");
 
   if(!A) {
 
-    GlobalVariable* G = module->getNamedGlobal(Name);
+    GlobalVariable* G = drv.Globals[Name];
 
-    if(!G) { return LogErrorV("Variabile "+Name+" not definita"); }
-    else { builder->CreateStore(V,G); return G; }
+    if(!G) { return LogErrorV("Variabile "+drv.name(Name).str()+" not definita"); }
+    if(drv.ParDepth && !G->isThreadLocal())
+      std::cerr << "Attenzione: parfor: il corpo assegna la variabile globale "
+                << drv.name(Name).str() << ", le iterazioni non sono indipendenti" << std::endl;
+    drv.builder->CreateStore(V,G); return G;
 
   }
-  else { builder->CreateStore(V,A); return A; }
+  else { drv.builder->CreateStore(V,A); return A; }
 }
 
 
@@ -532,20 +1705,45 @@ Value* AssignmentExprAST::codegen(driver& drv) {
 ForExprAST::ForExprAST(RootAST* Init, ExprAST* CondExp, AssignmentExprAST* Assignment, ExprAST* Statement): 
   Init(Init), CondExp(CondExp), Assignment(Assignment), Statement(Statement) {};
 
+ForExprAST::~ForExprAST() {
+  delete Init;
+  delete CondExp;
+  delete Assignment;
+  delete Statement;
+}
+
+void ForExprAST::setReductions(ReductionList R) {
+  Reductions = std::move(R);
+}
+
+// Variabile (locale o globale) di una clausola reduce, che nel corpo di un
+// parfor non può essere una copia di una variabile del chiamante
+static Value* reduction_target(driver& drv, symbol Name) {
+  AllocaInst* A = drv.NamedValues.lookup(Name);
+  if (A && std::find(drv.ParShared.begin(), drv.ParShared.end(), A) != drv.ParShared.end())
+    return LogErrorV("parfor: il corpo non può assegnare la variabile "+drv.name(Name).str()+" del chiamante");
+  if (A)
+    return A;
+  if (GlobalVariable* G = drv.Globals[Name])
+    return G;
+  return LogErrorV("Variabile "+drv.name(Name).str()+" not definita");
+}
+
 Value* ForExprAST::codegen(driver& drv) {
   //Genera i BB nella funzione attuale, inserisco subito quello responsabile per l'inizalizzazione;
-  Function *function = builder->GetInsertBlock()->getParent();
-  BasicBlock *EntryBB =  BasicBlock::Create(*context, "for_entry",function);
-  BasicBlock *CondBB = BasicBlock::Create(*context,"for_condition");
-  BasicBlock *LoopBB = BasicBlock::Create(*context, "for_body");
-  BasicBlock *ExitBB = BasicBlock::Create(*context, "for_exit");
+  Function *function = drv.builder->GetInsertBlock()->getParent();
+  BasicBlock *EntryBB =  BasicBlock::Create(*drv.context, "for_entry",function);
+  BasicBlock *CondBB = BasicBlock::Create(*drv.context,"for_condition");
+  BasicBlock *LoopBB = BasicBlock::Create(*drv.context, "for_body");
+  BasicBlock *ExitBB = BasicBlock::Create(*drv.context, "for_exit");
 
   //Creo il branch incodizionato tra function e EntryBB
-  builder->CreateBr(EntryBB);
-  builder -> SetInsertPoint(EntryBB);
+  drv.builder->CreateBr(EntryBB);
+  drv.builder->SetInsertPoint(EntryBB);
 
-  //Gestione delle variabili in Init
-  AllocaInst* AllocaTmp = nullptr;
+  //Gestione delle variabili in Init: l'eventuale variabile del ciclo è
+  //visibile solo nel ciclo, e vive quindi in uno scope proprio
+  drv.NamedValues.push_scope();
 
   auto* Node = dynamic_cast<VarBindingAST*>(Init);
   if(Node) {
@@ -554,8 +1752,7 @@ Value* ForExprAST::codegen(driver& drv) {
 
       if(!Val) return nullptr;
 
-      AllocaTmp = drv.NamedValues[Node->getName()];
-      drv.NamedValues[Node->getName()] = Val;
+      drv.NamedValues.bind(Node->getName(), Val);
   }
   else {
     auto* Node = dynamic_cast<AssignmentExprAST*>(Init);
@@ -565,48 +1762,406 @@ Value* ForExprAST::codegen(driver& drv) {
     if(!Val) return nullptr;
   }
 
+  //Le variabili di riduzione sono accumulate in copie private del ciclo
+  //(che LLVM può tenere nei registri anche se gli originali sono globali),
+  //ricopiate negli originali all'uscita
+  Type* DoubleTy = Type::getDoubleTy(*drv.context);
+  std::vector<std::pair<Value*,AllocaInst*>> Privates;
+  for (auto& R : Reductions) {
+    Value* Orig = reduction_target(drv, R.second);
+    if(!Orig) return nullptr;
+    AllocaInst* Acc = CreateEntryBlockAlloca(function, drv.name(R.second));
+    drv.builder->CreateStore(drv.builder->CreateLoad(DoubleTy, Orig, drv.name(R.second)), Acc);
+    drv.NamedValues.bind(R.second, Acc);
+    drv.Reductions.push_back({Acc, R.first});
+    Privates.push_back({Orig, Acc});
+  }
+
   //Branch incondizionato tra Entry e Condition, cambio InsertPoint del builder.
-  EntryBB = builder->GetInsertBlock();
+  EntryBB = drv.builder->GetInsertBlock();
   function->insert(function->end(),CondBB);
-  builder->CreateBr(CondBB);
-  builder->SetInsertPoint(CondBB);
+  drv.builder->CreateBr(CondBB);
+  drv.builder->SetInsertPoint(CondBB);
+
+  //Con la profilazione si contano le valutazioni della condizione e le
+  //iterazioni (back-edge): la loro differenza è il numero di uscite
+  unsigned site = drv.prof_site(2);
+  drv.prof_count(site);
 
   //Viene generata l'istruzione di branch condizionato.
   Value* condVal = CondExp -> codegen(drv);
   if(!condVal) return nullptr;
-  builder -> CreateCondBr(condVal,LoopBB,ExitBB);
+  uint64_t iters = drv.prof_value(site+1);
+  uint64_t exits = drv.prof_value(site) - std::min(iters, drv.prof_value(site));
+  drv.builder->CreateCondBr(condVal,LoopBB,ExitBB,drv.prof_weights({iters, exits}));
 
   //Inserisco LoopBB e cambio InsertPoint
-  CondBB = builder->GetInsertBlock();
+  CondBB = drv.builder->GetInsertBlock();
   function->insert(function->end(),LoopBB);
-  builder->SetInsertPoint(LoopBB);
+  drv.builder->SetInsertPoint(LoopBB);
+  drv.prof_count(site+1);
 
-  //Genera il body
+  //Genera il body, in cui break e continue saltano rispettivamente a
+  //ExitBB e al blocco del passo
+  drv.Loops.push_back({nullptr, ExitBB});
   Value* loopBody = Statement->codegen(drv);
+  BasicBlock* StepBB = drv.Loops.back().StepBB;
+  drv.Loops.pop_back();
   if(!loopBody) return nullptr;
 
+  //Se nel body c'è un continue, il passo ha un blocco proprio
+  if(StepBB) {
+    drv.builder->CreateBr(StepBB);
+    function->insert(function->end(),StepBB);
+    drv.builder->SetInsertPoint(StepBB);
+  }
+
   Value* stepAssignment = Assignment->codegen(drv);
   if(!stepAssignment) return nullptr;
 
   //Branch incodizionato a fine body per il ritorno a Condition
-  builder->CreateBr(CondBB);
+  drv.builder->CreateBr(CondBB);
 
   //Inserimento di ExitBB e cambio InsertPoint
-  LoopBB = builder->GetInsertBlock();
+  LoopBB = drv.builder->GetInsertBlock();
   function->insert(function->end(),ExitBB);
-  builder->SetInsertPoint(ExitBB);
+  drv.builder->SetInsertPoint(ExitBB);
+  for (auto& P : Privates)
+    drv.builder->CreateStore(drv.builder->CreateLoad(DoubleTy, P.second, P.second->getName()), P.first);
+  drv.Reductions.resize(drv.Reductions.size() - Privates.size());
 
-  //Restore della variabile in Init
-  if(AllocaTmp) drv.NamedValues[Node->getName()] = AllocaTmp;
+  //Restore dello scope esterno al ciclo
+  drv.NamedValues.pop_scope();
 
   //FOR restituisce 0.0 come da tutorial di LLVM
-  return Constant::getNullValue(Type::getDoubleTy(*context));
+  return Constant::getNullValue(Type::getDoubleTy(*drv.context));
+}
+
+
+/*********************** ParFor Expression Tree ***********************/
+ParForExprAST::ParForExprAST(symbol Var, ExprAST* Start, symbol CondVar, ExprAST* Bound,
+                             symbol StepVar, ExprAST* Step, ExprAST* Statement):
+  Var(Var), Start(Start), CondVar(CondVar), Bound(Bound), StepVar(StepVar), Step(Step),
+  Statement(Statement) {};
+
+ParForExprAST::~ParForExprAST() {
+  delete Start;
+  delete Bound;
+  delete Step;
+  delete Statement;
+}
+
+void ParForExprAST::setReductions(ReductionList R) {
+  Reductions = std::move(R);
+}
+
+// Combina atomicamente il valore V nella posizione P (un double di env) con
+// l'operazione della riduzione: cmpxchg sui 64 bit della posizione, ripetuto
+// finché nessun altro thread l'ha modificata fra la lettura e lo scambio
+static void atomic_combine(driver& drv, Value* P, Value* V, char Op) {
+  IRBuilder<>& B = *drv.builder;
+  Type* Int64Ty = B.getInt64Ty();
+  Function* F = B.GetInsertBlock()->getParent();
+  Value* IP = B.CreateBitCast(P, PointerType::getUnqual(Int64Ty));
+  Value* Init = B.CreateAlignedLoad(Int64Ty, IP, MaybeAlign(8), "reduce.old");
+  BasicBlock* Pred = B.GetInsertBlock();
+  BasicBlock* LoopBB = BasicBlock::Create(*drv.context, "reduce_combine", F);
+  BasicBlock* DoneBB = BasicBlock::Create(*drv.context, "reduce_done", F);
+  B.CreateBr(LoopBB);
+  B.SetInsertPoint(LoopBB);
+  PHINode* Old = B.CreatePHI(Int64Ty, 2, "old");
+  Old->addIncoming(Init, Pred);
+  Value* OldV = B.CreateBitCast(Old, B.getDoubleTy());
+  Value* New = Op == '+' ? B.CreateFAdd(OldV, V) : B.CreateFMul(OldV, V);
+  Value* Pair = B.CreateAtomicCmpXchg(IP, Old, B.CreateBitCast(New, Int64Ty), MaybeAlign(8),
+                                      AtomicOrdering::Monotonic, AtomicOrdering::Monotonic);
+  Old->addIncoming(B.CreateExtractValue(Pair, 0), LoopBB);
+  B.CreateCondBr(B.CreateExtractValue(Pair, 1), DoneBB, LoopBB);
+  B.SetInsertPoint(DoneBB);
+}
+
+// Il corpo del ciclo viene estratto in una funzione f.parfor(lo, hi, env),
+// che esegue le iterazioni di indice k in [lo, hi), con la variabile del
+// ciclo pari a start + k*step. Il numero delle iterazioni è calcolato prima
+// del ciclo, come ceil((bound - start) / step), e la funzione viene passata
+// a __kpar_for (runtime/kparallel.cpp), che distribuisce gli intervalli di
+// iterazioni fra i thread. Le variabili visibili del chiamante sono copiate,
+// insieme a start e step, nell'array env: nel corpo sono quindi private e
+// non assegnabili. Le iterazioni devono essere indipendenti, e un
+// assegnamento a una globale viene segnalato. Fanno eccezione le variabili
+// delle clausole reduce: ogni esecuzione della funzione del corpo accumula
+// in una variabile privata, inizializzata all'elemento neutro, e all'uscita
+// la combina atomicamente nella posizione di env della riduzione, che al
+// termine del ciclo viene combinata con la variabile del chiamante
+Value* ParForExprAST::codegen(driver& drv) {
+  if (CondVar != Var || StepVar != Var)
+    return LogErrorV("parfor: condizione e passo devono usare la variabile "+drv.name(Var).str());
+  Value* StartV = Start->codegen(drv);
+  if (!StartV) return nullptr;
+  Value* BoundV = Bound->codegen(drv);
+  if (!BoundV) return nullptr;
+  Value* StepV = Step->codegen(drv);
+  if (!StepV) return nullptr;
+
+  //Numero delle iterazioni (0 se negativo o non definito)
+  Type* DoubleTy = drv.builder->getDoubleTy();
+  Type* Int64Ty = drv.builder->getInt64Ty();
+  Value* N = drv.builder->CreateFDiv(drv.builder->CreateFSub(BoundV, StartV), StepV);
+  N = drv.builder->CreateIntrinsic(Intrinsic::ceil, {DoubleTy}, {N});
+  N = drv.builder->CreateSelect(drv.builder->CreateFCmpOGT(N, ConstantFP::get(DoubleTy, 0.0)),
+                                N, ConstantFP::get(DoubleTy, 0.0));
+  N = drv.builder->CreateFPToSI(N, Int64Ty, "parfor.n");
+
+  //Variabili del chiamante delle riduzioni e loro elementi neutri
+  std::vector<Value*> Targets;
+  for (auto& R : Reductions) {
+    Value* Orig = reduction_target(drv, R.second);
+    if (!Orig) return nullptr;
+    Targets.push_back(Orig);
+  }
+  auto identity = [&](char Op) { return ConstantFP::get(DoubleTy, Op == '+' ? 0.0 : 1.0); };
+
+  //Array env: start, step, le riduzioni e le variabili del chiamante
+  Function* Outer = drv.builder->GetInsertBlock()->getParent();
+  std::vector<symbol> Captured = drv.NamedValues.visible();
+  unsigned Base = 2 + Reductions.size();
+  ArrayType* EnvTy = ArrayType::get(DoubleTy, Captured.size() + Base);
+  IRBuilder<> TmpB(&Outer->getEntryBlock(), Outer->getEntryBlock().begin());
+  AllocaInst* Env = TmpB.CreateAlloca(EnvTy, nullptr, "parfor.env");
+  drv.builder->CreateStore(StartV, drv.builder->CreateConstGEP2_32(EnvTy, Env, 0, 0));
+  drv.builder->CreateStore(StepV, drv.builder->CreateConstGEP2_32(EnvTy, Env, 0, 1));
+  for (unsigned r = 0; r < Reductions.size(); r++)
+    drv.builder->CreateStore(identity(Reductions[r].first),
+                             drv.builder->CreateConstGEP2_32(EnvTy, Env, 0, r + 2));
+  for (unsigned k = 0; k < Captured.size(); k++) {
+    AllocaInst* A = drv.NamedValues.lookup(Captured[k]);
+    drv.builder->CreateStore(drv.builder->CreateLoad(DoubleTy, A, drv.name(Captured[k])),
+                             drv.builder->CreateConstGEP2_32(EnvTy, Env, 0, k + Base));
+  }
+
+  //Funzione del corpo: le copie delle variabili del chiamante nascondono,
+  //in uno scope proprio, gli originali
+  Type* EnvPtrTy = PointerType::getUnqual(DoubleTy);
+  FunctionType* BodyTy = FunctionType::get(drv.builder->getVoidTy(), {Int64Ty, Int64Ty, EnvPtrTy}, false);
+  Function* BodyF = Function::Create(BodyTy, Function::InternalLinkage,
+                                     Outer->getName() + ".parfor", *drv.module);
+  Argument* Lo = BodyF->getArg(0);
+  Argument* Hi = BodyF->getArg(1);
+  Argument* EnvArg = BodyF->getArg(2);
+  Lo->setName("lo");
+  Hi->setName("hi");
+  EnvArg->setName("env");
+  BasicBlock* OuterBB = drv.builder->GetInsertBlock();
+  BasicBlock* EntryBB = BasicBlock::Create(*drv.context, "entry", BodyF);
+  drv.builder->SetInsertPoint(EntryBB);
+  drv.NamedValues.push_scope();
+  std::vector<AllocaInst*> Shared;
+  for (unsigned k = 0; k < Captured.size(); k++) {
+    AllocaInst* A = CreateEntryBlockAlloca(BodyF, drv.name(Captured[k]));
+    drv.builder->CreateStore(drv.builder->CreateLoad(DoubleTy, drv.builder->CreateConstGEP1_32(DoubleTy, EnvArg, k + Base)), A);
+    drv.NamedValues.bind(Captured[k], A);
+    Shared.push_back(A);
+  }
+  std::vector<driver::Reduction> Accs;
+  for (auto& R : Reductions) {
+    AllocaInst* Acc = CreateEntryBlockAlloca(BodyF, drv.name(R.second));
+    drv.builder->CreateStore(identity(R.first), Acc);
+    drv.NamedValues.bind(R.second, Acc);
+    Accs.push_back({Acc, R.first});
+  }
+  Value* StartP = drv.builder->CreateLoad(DoubleTy, EnvArg, "start");
+  Value* StepP = drv.builder->CreateLoad(DoubleTy, drv.builder->CreateConstGEP1_32(DoubleTy, EnvArg, 1), "step");
+  AllocaInst* I = CreateEntryBlockAlloca(BodyF, drv.name(Var));
+  drv.NamedValues.bind(Var, I);
+
+  BasicBlock* CondBB = BasicBlock::Create(*drv.context, "parfor_condition", BodyF);
+  BasicBlock* LoopBB = BasicBlock::Create(*drv.context, "parfor_body", BodyF);
+  BasicBlock* StepBB = BasicBlock::Create(*drv.context, "parfor_step");
+  BasicBlock* ExitBB = BasicBlock::Create(*drv.context, "parfor_exit");
+  drv.builder->CreateBr(CondBB);
+  drv.builder->SetInsertPoint(CondBB);
+  PHINode* K = drv.builder->CreatePHI(Int64Ty, 2, "k");
+  K->addIncoming(Lo, EntryBB);
+  drv.builder->CreateCondBr(drv.builder->CreateICmpSLT(K, Hi), LoopBB, ExitBB);
+  drv.builder->SetInsertPoint(LoopBB);
+  drv.builder->CreateStore(drv.builder->CreateFAdd(StartP,
+                             drv.builder->CreateFMul(drv.builder->CreateSIToFP(K, DoubleTy), StepP)), I);
+
+  //Nel corpo continue passa all'iterazione successiva, mentre break non è
+  //ammesso (e i cicli del chiamante non sono visibili)
+  std::vector<driver::LoopContext> OuterLoops{{StepBB, nullptr}};
+  std::swap(drv.Loops, OuterLoops);
+  std::swap(drv.ParShared, Shared);
+  std::swap(drv.Reductions, Accs);
+  drv.ParDepth++;
+  Value* BodyV = Statement->codegen(drv);
+  drv.ParDepth--;
+  std::swap(drv.Reductions, Accs);
+  std::swap(drv.ParShared, Shared);
+  std::swap(drv.Loops, OuterLoops);
+  drv.NamedValues.pop_scope();
+  if (!BodyV) {
+    // Eliminando BodyF si rimuovono i salti (di continue e della condizione)
+    // ai blocchi non ancora inseriti, che solo allora possono essere liberati
+    BodyF->eraseFromParent();
+    delete StepBB;
+    delete ExitBB;
+    drv.builder->SetInsertPoint(OuterBB);
+    return nullptr;
+  }
+  drv.builder->CreateBr(StepBB);
+  BodyF->insert(BodyF->end(), StepBB);
+  drv.builder->SetInsertPoint(StepBB);
+  Value* Next = drv.builder->CreateAdd(K, drv.builder->getInt64(1), "nextk");
+  drv.builder->CreateBr(CondBB);
+  K->addIncoming(Next, StepBB);
+  BodyF->insert(BodyF->end(), ExitBB);
+  drv.builder->SetInsertPoint(ExitBB);
+  for (unsigned r = 0; r < Accs.size(); r++)
+    atomic_combine(drv, drv.builder->CreateConstGEP1_32(DoubleTy, EnvArg, r + 2),
+                   drv.builder->CreateLoad(DoubleTy, Accs[r].Acc, Accs[r].Acc->getName()), Accs[r].Op);
+  drv.builder->CreateRetVoid();
+  drv.Outlined.push_back(BodyF);
+
+  drv.builder->SetInsertPoint(OuterBB);
+  drv.builder->CreateCall(drv.runtime("__kpar_for"),
+                          {BodyF, drv.builder->CreateConstGEP2_32(EnvTy, Env, 0, 0), N});
+  for (unsigned r = 0; r < Reductions.size(); r++) {
+    Value* Orig = drv.builder->CreateLoad(DoubleTy, Targets[r], drv.name(Reductions[r].second));
+    Value* Part = drv.builder->CreateLoad(DoubleTy, drv.builder->CreateConstGEP2_32(EnvTy, Env, 0, r + 2));
+    drv.builder->CreateStore(Reductions[r].first == '+' ? drv.builder->CreateFAdd(Orig, Part)
+                                                        : drv.builder->CreateFMul(Orig, Part),
+                             Targets[r]);
+  }
+  return Constant::getNullValue(DoubleTy);
+}
+
+/*********************** Spawn Expression Tree ***********************/
+SpawnExprAST::SpawnExprAST(symbol Callee, std::vector<ExprAST*> Args):
+  Assigns(false), Dest(0), Callee(Callee), Args(std::move(Args)) {};
+
+SpawnExprAST::SpawnExprAST(symbol Dest, symbol Callee, std::vector<ExprAST*> Args):
+  Assigns(true), Dest(Dest), Callee(Callee), Args(std::move(Args)) {};
+
+SpawnExprAST::~SpawnExprAST() {
+  for (auto arg : Args)
+    delete arg;
+}
+
+// Contatore dei task della funzione corrente, allocato e azzerato
+// all'inizio della funzione
+static AllocaInst* spawn_pending(driver& drv) {
+  if (!drv.SpawnPending) {
+    Function* F = drv.builder->GetInsertBlock()->getParent();
+    IRBuilder<> TmpB(&F->getEntryBlock(), F->getEntryBlock().begin());
+    drv.SpawnPending = TmpB.CreateAlloca(TmpB.getInt64Ty(), nullptr, "spawn.pending");
+    TmpB.CreateAlignedStore(TmpB.getInt64(0), drv.SpawnPending, MaybeAlign(8));
+  }
+  return drv.SpawnPending;
+}
+
+// Gli argomenti vengono valutati subito e copiati dal supporto a tempo di
+// esecuzione, mentre la chiamata è eseguita da una funzione f.spawn(args,
+// result) che scrive il risultato nella variabile assegnata (o in una
+// posizione propria, se il risultato non serve). La variabile deve essere
+// locale: il suo valore è indefinito fino a sync, che il supporto esegue
+// anche implicitamente alla fine della funzione. Sotto una certa profondità
+// di spawn (runtime/ktask.cpp) la chiamata viene eseguita subito
+Value* SpawnExprAST::codegen(driver& drv) {
+  if (drv.ParDepth)
+    return LogErrorV("spawn nel corpo di un parfor");
+  Function *CalleeF = drv.Functions[Callee];
+  if (!CalleeF)
+    return LogErrorV("Funzione non definita");
+  if (CalleeF->arg_size() != Args.size())
+    return LogErrorV("Numero di argomenti non corretto");
+  Function* Outer = drv.builder->GetInsertBlock()->getParent();
+  Type* DoubleTy = drv.builder->getDoubleTy();
+  Type* Ptr = PointerType::getUnqual(DoubleTy);
+  // Il risultato di uno spawn non assegnato non viene scritto: al task si
+  // passa un puntatore nullo (più task dello stesso spawn, ad esempio in un
+  // ciclo, scriverebbero altrimenti tutti nella stessa locazione)
+  Value* Result = ConstantPointerNull::get(cast<PointerType>(Ptr));
+  if (Assigns) {
+    AllocaInst* A = drv.NamedValues.lookup(Dest);
+    if (!A)
+      return LogErrorV("spawn: il risultato va assegnato a una variabile locale");
+    for (auto& R : drv.Reductions)
+      if (R.Acc == A)
+        return LogErrorV("spawn: "+drv.name(Dest).str()+" è una variabile di riduzione");
+    Result = A;
+  }
+
+  ArrayType* ArgsTy = ArrayType::get(DoubleTy, Args.size());
+  IRBuilder<> TmpB(&Outer->getEntryBlock(), Outer->getEntryBlock().begin());
+  AllocaInst* ArgsA = TmpB.CreateAlloca(ArgsTy, nullptr, "spawn.args");
+  for (unsigned k = 0; k < Args.size(); k++) {
+    Value* V = Args[k]->codegen(drv);
+    if (!V) return nullptr;
+    drv.builder->CreateStore(V, drv.builder->CreateConstGEP2_32(ArgsTy, ArgsA, 0, k));
+  }
+
+  Function* Fn = Function::Create(FunctionType::get(drv.builder->getVoidTy(), {Ptr, Ptr}, false),
+                                  Function::InternalLinkage, Outer->getName() + ".spawn", *drv.module);
+  Fn->getArg(0)->setName("args");
+  Fn->getArg(1)->setName("result");
+  IRBuilder<> B(BasicBlock::Create(*drv.context, "entry", Fn));
+  std::vector<Value*> ArgsV;
+  for (unsigned k = 0; k < Args.size(); k++)
+    ArgsV.push_back(B.CreateLoad(DoubleTy, B.CreateConstGEP1_32(DoubleTy, Fn->getArg(0), k)));
+  Value* Call = B.CreateCall(CalleeF, ArgsV, "calltmp");
+  if (Assigns)
+    B.CreateStore(Call, Fn->getArg(1));
+  B.CreateRetVoid();
+  drv.Outlined.push_back(Fn);
+
+  drv.builder->CreateCall(drv.runtime("__kspawn"),
+                          {spawn_pending(drv), Fn, drv.builder->CreateConstGEP2_32(ArgsTy, ArgsA, 0, 0),
+                           drv.builder->getInt64(Args.size()), Result});
+  return Constant::getNullValue(DoubleTy);
 }
 
+/*********************** Sync Expression Tree ***********************/
+Value* SyncExprAST::codegen(driver& drv) {
+  if (drv.ParDepth)
+    return LogErrorV("sync nel corpo di un parfor");
+  drv.builder->CreateCall(drv.runtime("__ksync"), {spawn_pending(drv)});
+  return Constant::getNullValue(drv.builder->getDoubleTy());
+}
+
+/*********************** Jump Expression Tree ***********************/
+JumpExprAST::JumpExprAST(char Kind): Kind(Kind) {};
+
+// break e continue saltano all'uscita o al passo del ciclo più interno. Il
+// codice che segue nello stesso blocco del sorgente non è raggiungibile e
+// viene generato in un nuovo basic block (senza predecessori), così che
+// ogni blocco abbia un'unica istruzione di terminazione
+Value* JumpExprAST::codegen(driver& drv) {
+  if (drv.Loops.empty())
+    return LogErrorV(Kind == 'B' ? "break fuori da un ciclo" : "continue fuori da un ciclo");
+  driver::LoopContext& L = drv.Loops.back();
+  Function *function = drv.builder->GetInsertBlock()->getParent();
+  if (Kind == 'B' && !L.ExitBB)
+    return LogErrorV("break nel corpo di un parfor");
+  if (Kind == 'B') {
+    drv.builder->CreateBr(L.ExitBB);
+  } else {
+    if (!L.StepBB)
+      L.StepBB = BasicBlock::Create(*drv.context, "for_step");
+    drv.builder->CreateBr(L.StepBB);
+  }
+  drv.builder->SetInsertPoint(BasicBlock::Create(*drv.context, "unreachable", function));
+  return Constant::getNullValue(Type::getDoubleTy(*drv.context));
+}
 
 /*********************** Boolean Expression Tree ***********************/
 BooleanExprAST::BooleanExprAST(char Op, ExprAST* LHS, ExprAST* RHS): Op(Op), LHS(LHS), RHS(RHS) {};
 
+BooleanExprAST::~BooleanExprAST() {
+  delete LHS;
+  delete RHS;
+}
+
 Value* BooleanExprAST::codegen(driver& drv) {
   Value *L = LHS->codegen(drv);
   Value *R = RHS ? RHS->codegen(drv) : nullptr;
@@ -614,13 +2169,727 @@ Value* BooleanExprAST::codegen(driver& drv) {
 
   switch(Op){
     case 'A':
-      return builder->CreateAnd(L,R,"andres");
+      return drv.builder->CreateAnd(L,R,"andres");
     case 'O':
-      return builder->CreateOr(L,R,"orres");
+      return drv.builder->CreateOr(L,R,"orres");
     case 'N':
-      return builder->CreateNot(L,"notres");
+      return drv.builder->CreateNot(L,"notres");
     default:
       std::cout << Op << std::endl;
       return LogErrorV("Operatore booleano non supportato");
   }
 };
+
+
+/*********************** Profiling ***********************/
+// Con -fprofile-generate ogni funzione f riceve un array privato di contatori
+// (@__kprof.f), incrementati nei punti numerati da prof_site. Poiché il numero
+// dei contatori è noto solo alla fine della generazione del codice, durante
+// la generazione gli incrementi fanno riferimento a un segnaposto, sostituito
+// poi dall'array vero e proprio. Un costruttore del modulo registra gli array
+// presso il supporto a tempo di esecuzione (runtime/kprofile.cpp), che al
+// termine del programma ne accoda i valori al file del profilo
+void driver::prof_begin(Function* F) {
+  ProfSites = 0;
+  ProfCounters = nullptr;
+  ProfValues = nullptr;
+  if (profile_generate)
+    ProfCounters = new GlobalVariable(*module, builder->getInt64Ty(), false,
+                                      GlobalValue::PrivateLinkage,
+                                      builder->getInt64(0), "__kprof.tmp");
+  if (profile) {
+    auto it = profile->Counts.find(F->getName());
+    if (it != profile->Counts.end())
+      ProfValues = &it->second;
+  }
+  prof_count(prof_site());  // Ingressi nella funzione
+}
+
+// Fine della generazione del codice di F (ok è falso in caso di errore, e il
+// corpo di F è stato allora già eliminato)
+void driver::prof_end(Function* F, bool ok) {
+  if (ProfCounters) {
+    if (ok) {
+      ArrayType* T = ArrayType::get(builder->getInt64Ty(), ProfSites);
+      auto* G = new GlobalVariable(*module, T, false, GlobalValue::InternalLinkage,
+                                   ConstantAggregateZero::get(T),
+                                   "__kprof." + F->getName());
+      ProfCounters->replaceAllUsesWith(ConstantExpr::getPointerCast(G, ProfCounters->getType()));
+      ProfPending.emplace_back(F->getName().str(), G);
+    }
+    ProfCounters->eraseFromParent();
+    ProfCounters = nullptr;
+  }
+  if (!ok || !ProfValues)
+    return;
+  // Un profilo con un numero diverso di contatori è stato prodotto da una
+  // versione precedente della funzione e non viene usato
+  if (ProfValues->size() != ProfSites) {
+    std::cerr << "Profilo di " << F->getName().str() << " non aggiornato: ignorato" << std::endl;
+    for (auto& BB : *F)
+      for (auto& I : BB)
+        I.setMetadata(LLVMContext::MD_prof, nullptr);
+  } else {
+    F->setEntryCount((*ProfValues)[0]);
+  }
+  ProfValues = nullptr;
+}
+
+unsigned driver::prof_site(unsigned n) {
+  unsigned site = ProfSites;
+  ProfSites += n;
+  return site;
+}
+
+// L'incremento è atomico (monotonic, senza ordinamento rispetto agli altri
+// accessi): il codice di una funzione può essere eseguito in parallelo dal
+// corpo di un parfor, da un task o dai thread del programma, e con una
+// semplice lettura seguita da una scrittura alcuni incrementi andrebbero persi
+void driver::prof_count(unsigned site) {
+  if (!ProfCounters)
+    return;
+  Type* I64 = builder->getInt64Ty();
+  Value* P = builder->CreateConstGEP1_32(I64, ProfCounters, site, "prof.ptr");
+  builder->CreateAtomicRMW(AtomicRMWInst::Add, P, builder->getInt64(1), MaybeAlign(8),
+                           AtomicOrdering::Monotonic);
+}
+
+uint64_t driver::prof_value(unsigned site) const {
+  return ProfValues && site < ProfValues->size() ? (*ProfValues)[site] : 0;
+}
+
+// Pesi (branch_weights) dei rami di un salto condizionato o, con un solo
+// valore, di una chiamata; nullptr se la funzione corrente non ha profilo.
+// I pesi sono a 32 bit: i valori vengono quindi scalati e, come fa clang,
+// incrementati di uno, così che un ramo mai eseguito resti poco probabile
+// ma non impossibile
+MDNode* driver::prof_weights(ArrayRef<uint64_t> counts) {
+  if (!ProfValues)
+    return nullptr;
+  uint64_t max = 0;
+  for (uint64_t c : counts)
+    max = std::max(max, c);
+  uint64_t scale = max / UINT32_MAX + 1;
+  std::vector<uint32_t> weights;
+  for (uint64_t c : counts)
+    weights.push_back(c / scale + 1);
+  return MDBuilder(*context).createBranchWeights(weights);
+}
+
+// Aggiunge al modulo un costruttore che registra presso il supporto a tempo
+// di esecuzione gli array dei contatori delle funzioni generate finora
+void driver::prof_register() {
+  if (ProfPending.empty())
+    return;
+  Type* I64 = builder->getInt64Ty();
+  FunctionCallee Reg = module->getOrInsertFunction("__kprof_register",
+      builder->getVoidTy(), builder->getInt8PtrTy(), I64->getPointerTo(), I64);
+  Function* Init = Function::Create(FunctionType::get(builder->getVoidTy(), false),
+                                    GlobalValue::InternalLinkage, "__kprof_init", *module);
+  builder->SetInsertPoint(BasicBlock::Create(*context, "entry", Init));
+  for (auto& [name, G] : ProfPending)
+    builder->CreateCall(Reg, {builder->CreateGlobalStringPtr(name, "__kprof.name"),
+                              builder->CreateConstGEP2_32(G->getValueType(), G, 0, 0),
+                              builder->getInt64(G->getValueType()->getArrayNumElements())});
+  builder->CreateRetVoid();
+  appendToGlobalCtors(*module, Init, 0);
+  ProfPending.clear();
+}
+
+// Lettura del profilo: una riga per funzione ed esecuzione, con il nome della
+// funzione, il numero dei contatori e i loro valori. Le righe della stessa
+// funzione vengono sommate
+int ProfileCounts::load(const std::string& file) {
+  auto buf = MemoryBuffer::getFile(file);
+  if (!buf) {
+    std::cerr << "cannot open " << file << ": " << buf.getError().message() << std::endl;
+    return 1;
+  }
+  for (line_iterator it(**buf); !it.is_at_end(); ++it) {
+    SmallVector<StringRef, 16> fields;
+    it->split(fields, ' ', -1, false);
+    uint64_t n;
+    if (fields.size() < 2 || fields[1].getAsInteger(10, n) || fields.size() != n + 2) {
+      std::cerr << file << ":" << it.line_number() << ": riga non valida" << std::endl;
+      return 1;
+    }
+    std::vector<uint64_t>& counts = Counts[fields[0]];
+    if (counts.empty())
+      counts.resize(n);
+    if (counts.size() != n)
+      continue;
+    for (size_t i = 0; i < n; i++) {
+      uint64_t c;
+      if (fields[i + 2].getAsInteger(10, c)) {
+        std::cerr << file << ":" << it.line_number() << ": riga non valida" << std::endl;
+        return 1;
+      }
+      counts[i] += c;
+    }
+  }
+  InstrProfSummaryBuilder B(ProfileSummaryBuilder::DefaultCutoffs);
+  for (auto& entry : Counts)
+    B.addRecord(InstrProfRecord(entry.second));
+  Summary = B.getSummary();
+  return 0;
+}
+
+/*********************** Memoization ***********************/
+// Una funzione memo def ha una tabella (globale interna) di memo_size
+// posizioni a indirizzamento aperto: per ogni posizione un flag di
+// occupazione, i bit degli argomenti (la chiave) e il risultato. Prima del
+// corpo la funzione calcola l'hash degli argomenti e ne esamina al più
+// MemoProbes posizioni consecutive: se trova la chiave restituisce il
+// risultato memorizzato, altrimenti esegue il corpo e memorizza il
+// risultato nella prima posizione libera incontrata. Se le posizioni sono
+// tutte occupate, con memo_evict il risultato sostituisce quello nella
+// posizione iniziale, altrimenti va nella posizione aggiuntiva memo_size,
+// che non viene mai letta. Come una threadlocal global, la tabella ha una
+// copia per ogni thread, per cui una funzione memo def può essere chiamata
+// anche nel corpo di un parfor o da uno spawn senza sincronizzazioni
+static const unsigned MemoProbes = 4;
+
+void driver::memo_begin(Function* F) {
+  Type *I64 = builder->getInt64Ty();
+  uint64_t C = memo_size;
+  ArrayType *KeyT = ArrayType::get(I64, F->arg_size());
+  ArrayType *UsedT = ArrayType::get(builder->getInt8Ty(), C + 1);
+  ArrayType *KeysT = ArrayType::get(KeyT, C + 1);
+  ArrayType *ValsT = ArrayType::get(builder->getDoubleTy(), C + 1);
+  auto table = [&](ArrayType *T, StringRef what) {
+    auto *G = new GlobalVariable(*module, T, false, GlobalValue::InternalLinkage,
+                                 ConstantAggregateZero::get(T),
+                                 F->getName() + ".memo." + what);
+    G->setThreadLocalMode(GlobalValue::InitialExecTLSModel);
+    return G;
+  };
+  MemoGlobals = {table(UsedT, "used"), table(KeysT, "keys"), table(ValsT, "vals")};
+
+  // Hash degli argomenti (i loro bit, per cui anche NaN e -0 sono chiavi),
+  // mescolati con la funzione finale di MurmurHash3: i valori interi, i più
+  // comuni, differiscono soltanto nei bit alti
+  MemoKey.clear();
+  Value *Hash = builder->getInt64(0);
+  for (auto &Arg : F->args()) {
+    MemoKey.push_back(builder->CreateBitCast(&Arg, I64, "memo.key"));
+    if (MemoKey.size() > 1)
+      Hash = builder->CreateXor(Hash, MemoKey.back());
+    else
+      Hash = MemoKey.back();
+    for (uint64_t M : {0xff51afd7ed558ccdULL, 0xc4ceb9fe1a85ec53ULL}) {
+      Hash = builder->CreateXor(Hash, builder->CreateLShr(Hash, 33));
+      Hash = builder->CreateMul(Hash, builder->getInt64(M));
+    }
+    Hash = builder->CreateXor(Hash, builder->CreateLShr(Hash, 33), "memo.hash");
+  }
+  Value *Home = builder->CreateAnd(Hash, C - 1, "memo.home");
+  IRBuilder<> TmpB(&F->getEntryBlock(), F->getEntryBlock().begin());
+  MemoSlot = TmpB.CreateAlloca(I64, nullptr, "memo.slot");
+  builder->CreateStore(memo_evict ? Home : builder->getInt64(C), MemoSlot);
+
+  BasicBlock *EntryBB = builder->GetInsertBlock();
+  BasicBlock *ProbeBB = BasicBlock::Create(*context, "memo_probe", F);
+  BasicBlock *FreeBB = BasicBlock::Create(*context, "memo_free", F);
+  BasicBlock *CheckBB = BasicBlock::Create(*context, "memo_check", F);
+  BasicBlock *NextBB = BasicBlock::Create(*context, "memo_next", F);
+  BasicBlock *HitBB = BasicBlock::Create(*context, "memo_hit", F);
+  BasicBlock *MissBB = BasicBlock::Create(*context, "memo_miss", F);
+  builder->CreateBr(ProbeBB);
+
+  builder->SetInsertPoint(ProbeBB);
+  PHINode *I = builder->CreatePHI(I64, 2, "memo.i");
+  I->addIncoming(builder->getInt64(0), EntryBB);
+  Value *Slot = builder->CreateAnd(builder->CreateAdd(Home, I), C - 1, "memo.pos");
+  Value *Used = builder->CreateLoad(builder->getInt8Ty(),
+      builder->CreateInBoundsGEP(UsedT, MemoGlobals[0], {builder->getInt64(0), Slot}));
+  builder->CreateCondBr(builder->CreateICmpEQ(Used, builder->getInt8(0)), FreeBB, CheckBB);
+
+  // Posizione libera: la chiave non è nella tabella e il risultato andrà qui
+  builder->SetInsertPoint(FreeBB);
+  builder->CreateStore(Slot, MemoSlot);
+  builder->CreateBr(MissBB);
+
+  builder->SetInsertPoint(CheckBB);
+  Value *Eq = builder->getTrue();
+  for (unsigned k = 0; k < MemoKey.size(); k++) {
+    Value *Key = builder->CreateLoad(I64, builder->CreateInBoundsGEP(
+        KeysT, MemoGlobals[1], {builder->getInt64(0), Slot, builder->getInt64(k)}));
+    Value *KeyEq = builder->CreateICmpEQ(Key, MemoKey[k], "memo.eq");
+    Eq = k ? builder->CreateAnd(Eq, KeyEq) : KeyEq;
+  }
+  builder->CreateCondBr(Eq, HitBB, NextBB);
+
+  builder->SetInsertPoint(NextBB);
+  Value *Next = builder->CreateAdd(I, builder->getInt64(1));
+  I->addIncoming(Next, NextBB);
+  builder->CreateCondBr(builder->CreateICmpULT(Next, builder->getInt64(MemoProbes)),
+                        ProbeBB, MissBB);
+
+  builder->SetInsertPoint(HitBB);
+  builder->CreateRet(builder->CreateLoad(builder->getDoubleTy(), builder->CreateInBoundsGEP(
+      ValsT, MemoGlobals[2], {builder->getInt64(0), Slot}), "memo.val"));
+
+  builder->SetInsertPoint(MissBB);
+}
+
+// Memorizza il risultato RetVal della funzione corrente, prima del return
+void driver::memo_end(Value* RetVal) {
+  Type *I64 = builder->getInt64Ty();
+  auto *UsedT = cast<ArrayType>(MemoGlobals[0]->getValueType());
+  auto *KeysT = cast<ArrayType>(MemoGlobals[1]->getValueType());
+  auto *ValsT = cast<ArrayType>(MemoGlobals[2]->getValueType());
+  Value *Slot = builder->CreateLoad(I64, MemoSlot, "memo.slot");
+  builder->CreateStore(builder->getInt8(1), builder->CreateInBoundsGEP(
+      UsedT, MemoGlobals[0], {builder->getInt64(0), Slot}));
+  for (unsigned k = 0; k < MemoKey.size(); k++)
+    builder->CreateStore(MemoKey[k], builder->CreateInBoundsGEP(
+        KeysT, MemoGlobals[1], {builder->getInt64(0), Slot, builder->getInt64(k)}));
+  builder->CreateStore(RetVal, builder->CreateInBoundsGEP(
+      ValsT, MemoGlobals[2], {builder->getInt64(0), Slot}));
+}
+
+// Le tabelle vengono emesse insieme alla funzione (e con essa memorizzate
+// nella cache delle funzioni compilate)
+void driver::memo_print(raw_ostream& os) {
+  for (GlobalVariable* G : MemoGlobals) {
+    G->print(os);
+    os << "\n";
+  }
+}
+
+// Rimuove le tabelle di una funzione la cui definizione è fallita
+void driver::memo_discard() {
+  for (GlobalVariable* G : MemoGlobals)
+    G->eraseFromParent();
+  MemoGlobals.clear();
+}
+
+/*********************** Function cache ***********************/
+// La cache delle funzioni compilate (opzione -cache DIR) è una directory
+// indirizzata per contenuto: il codice emesso per una funzione viene salvato
+// nel file DIR/<chiave>.ll, dove la chiave è l'hash MD5 di una rappresentazione
+// normalizzata della definizione. Questa comprende il corpo della funzione,
+// la firma (tipo e attributi) delle funzioni chiamate, la definizione delle
+// variabili globali usate e le opzioni di compilazione che influiscono sul
+// codice. Se nessuno di questi elementi cambia, il codice in cache è identico
+// a quello che verrebbe generato, per cui la funzione non viene ricompilata.
+// Il prefisso kcomp-N va incrementato quando cambia la traduzione, così che
+// le voci prodotte dalle versioni precedenti non vengano più usate
+std::string driver::cache_key(FunctionAST& F) {
+  std::string text;
+  raw_string_ostream os(text);
+  os << "kcomp-13;O" << optlevel << ";M" << memo_size << memo_evict << ';';
+  F.fingerprint(*this, os);
+  os.flush();
+  MD5 Hash;
+  Hash.update(text);
+  MD5::MD5Result Res;
+  Hash.final(Res);
+  return Res.digest().str().str();
+}
+
+bool driver::cache_lookup(StringRef key, std::string& text) {
+  SmallString<128> path(cachedir);
+  sys::path::append(path, key + ".ll");
+  auto Buf = MemoryBuffer::getFile(path);
+  if (!Buf)
+    return false;
+  text = (*Buf)->getBuffer().str();
+  return true;
+}
+
+// Il file viene scritto con un nome temporaneo e poi rinominato, così che
+// thread o processi kcomp concorrenti non leggano mai un file incompleto
+void driver::cache_store(StringRef key, StringRef text) {
+  SmallString<128> path(cachedir);
+  sys::path::append(path, key + ".ll");
+  Expected<sys::fs::TempFile> Tmp = sys::fs::TempFile::create(path + ".%%%%%%.tmp");
+  if (!Tmp) {
+    consumeError(Tmp.takeError());
+    return;
+  }
+  raw_fd_ostream os(Tmp->FD, false);
+  os << text;
+  os.flush();
+  if (Error E = Tmp->keep(path))
+    consumeError(std::move(E));
+}
+
+// Un nome usato come variabile può riferirsi ad una globale: in tal caso
+// ne fa parte anche la definizione (tipo, linkage, ...)
+static void fingerprint_name(driver& drv, symbol Name, raw_ostream& os) {
+  os << drv.name(Name) << ';';
+  if (GlobalVariable* G = drv.Globals[Name]) {
+    G->print(os);
+    os << ';';
+  }
+}
+
+void NumberExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'N' << DoubleToBits(Val) << ';';
+}
+
+void VariableExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'V';
+  fingerprint_name(drv, Name, os);
+}
+
+void BinaryExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'B' << Op << '(';
+  LHS->fingerprint(drv, os);
+  RHS->fingerprint(drv, os);
+  os << ')';
+}
+
+// Una chiamata valutata a tempo di compilazione ha l'impronta della
+// costante che la sostituisce
+void CallExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  if (fold(drv)) {
+    os << 'N' << DoubleToBits(Result) << ';';
+    return;
+  }
+  os << 'C' << drv.name(Callee) << '/' << Args.size() << '{';
+  if (Function *F = drv.Functions[Callee]) {
+    F->getFunctionType()->print(os);
+    os << F->getAttributes().getFnAttrs().getAsString();
+  }
+  os << "}(";
+  for (auto arg : Args)
+    arg->fingerprint(drv, os);
+  os << ')';
+}
+
+void IfExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << "I(";
+  Cond->fingerprint(drv, os);
+  TrueExp->fingerprint(drv, os);
+  if (FalseExp)
+    FalseExp->fingerprint(drv, os);
+  os << ')';
+}
+
+void BlockExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << "K(";
+  for (auto def : Def)
+    def->fingerprint(drv, os);
+  os << '|';
+  for (auto val : Val)
+    val->fingerprint(drv, os);
+  os << ')';
+}
+
+void VarBindingAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'D' << drv.name(Name) << "=(";
+  if (Val)
+    Val->fingerprint(drv, os);
+  os << ')';
+}
+
+void PrototypeAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'P' << drv.name(Name) << '(';
+  for (auto arg : Args)
+    os << drv.name(arg) << ',';
+  os << ')' << Attrs << ';';
+}
+
+void FunctionAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'F';
+  Proto->fingerprint(drv, os);
+  Body->fingerprint(drv, os);
+}
+
+void GlobalAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << (ThreadLocal ? "GT" : "G") << drv.name(Name) << ';';
+}
+
+void AssignmentExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'A';
+  fingerprint_name(drv, Name, os);
+  os << '(';
+  Val->fingerprint(drv, os);
+  os << ')';
+}
+
+static void fingerprint_reductions(driver& drv, const ReductionList& R, raw_ostream& os) {
+  for (auto& r : R) {
+    os << 'R' << r.first;
+    fingerprint_name(drv, r.second, os);
+  }
+}
+
+void ForExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << "L(";
+  Init->fingerprint(drv, os);
+  CondExp->fingerprint(drv, os);
+  Assignment->fingerprint(drv, os);
+  fingerprint_reductions(drv, Reductions, os);
+  Statement->fingerprint(drv, os);
+  os << ')';
+}
+
+void ParForExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'Q' << drv.name(Var) << ';' << drv.name(CondVar) << ';' << drv.name(StepVar) << "(";
+  Start->fingerprint(drv, os);
+  Bound->fingerprint(drv, os);
+  Step->fingerprint(drv, os);
+  fingerprint_reductions(drv, Reductions, os);
+  Statement->fingerprint(drv, os);
+  os << ')';
+}
+
+void SpawnExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'S';
+  if (Assigns)
+    fingerprint_name(drv, Dest, os);
+  os << '=' << drv.name(Callee) << '/' << Args.size() << '{';
+  if (Function *F = drv.Functions[Callee]) {
+    F->getFunctionType()->print(os);
+    os << F->getAttributes().getFnAttrs().getAsString();
+  }
+  os << "}(";
+  for (auto arg : Args)
+    arg->fingerprint(drv, os);
+  os << ')';
+}
+
+void SyncExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'Y';
+}
+
+void JumpExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'J' << Kind;
+}
+
+void BooleanExprAST::fingerprint(driver& drv, raw_ostream& os) {
+  os << 'O' << Op << '(';
+  LHS->fingerprint(drv, os);
+  if (RHS)
+    RHS->fingerprint(drv, os);
+  os << ')';
+}
+
+/*************** Valutazione a tempo di compilazione ***************/
+// Una chiamata di una funzione pure definita in precedenza (o di una
+// funzione predefinita) con argomenti costanti viene valutata da un
+// interprete dell'AST e sostituita dal suo valore: fact(10) diventa la
+// costante 3628800 e il codice della chiamata non viene generato.
+// L'interprete calcola come il codice generato (operazioni in double,
+// confronti non ordinati, fmod per frem) e rinuncia, lasciando la chiamata
+// al tempo di esecuzione, quando incontra una variabile globale o una
+// funzione non pura o non ancora definita, o quando esaurisce i passi: al
+// più eval_steps per chiamata ed eval_fuel per tutte le chiamate di una
+// funzione. I passi garantiscono la terminazione anche di una funzione che,
+// contrariamente all'annotazione, non termina; l'annidamento è limitato
+// per non esaurire lo stack del C++
+static const unsigned MaxEvalDepth = 10000;
+
+struct ConstEval {
+  driver& drv;
+  uint64_t steps;               // Passi ancora disponibili
+  unsigned depth = 0;           // Valutazioni annidate in corso
+  char jump = 0;                // break ('B') o continue ('C') in corso
+  std::vector<std::pair<symbol,double>> Vars; // Variabili visibili, dalla più esterna
+  size_t frame = 0;             // Prima variabile della funzione corrente
+  ConstEval(driver& drv, uint64_t steps): drv(drv), steps(steps) {};
+  double* lookup(symbol Name) {
+    for (size_t i = Vars.size(); i > frame; i--)
+      if (Vars[i-1].first == Name)
+        return &Vars[i-1].second;
+    return nullptr;
+  }
+  bool call(symbol Callee, const std::vector<ExprAST*>& Args, double& V);
+};
+
+// Ogni valutazione consuma un passo e occupa un livello di annidamento
+struct EvalStep {
+  ConstEval& E;
+  bool ok;
+  EvalStep(ConstEval& E): E(E), ok(E.steps > 0 && E.depth < MaxEvalDepth) {
+    E.steps -= ok;
+    E.depth++;
+  }
+  ~EvalStep() { E.depth--; }
+};
+
+bool ConstEval::call(symbol Callee, const std::vector<ExprAST*>& Args, double& V) {
+  StringRef Name = drv.name(Callee);
+  const auto* B = std::find_if(std::begin(Builtins), std::end(Builtins), [&](const auto& B) {
+    return B.Name == Name && B.Args == Args.size();
+  });
+  const driver::PureDef& P = drv.PureDefs[Callee];
+  if (B == std::end(Builtins) && (!P.Def || P.Item >= drv.CurrentItem))
+    return false;
+  SmallVector<double, 4> ArgsV;
+  for (auto arg : Args) {
+    ArgsV.push_back(0);
+    if (!arg->eval(*this, ArgsV.back()))
+      return false;
+  }
+  if (B == std::end(Builtins))
+    return P.Def->apply(*this, ArgsV, V);
+  switch (B->ID) {
+  case Intrinsic::floor: V = std::floor(ArgsV[0]); break;
+  case Intrinsic::sqrt:  V = std::sqrt(ArgsV[0]); break;
+  case Intrinsic::fabs:  V = std::fabs(ArgsV[0]); break;
+  case Intrinsic::pow:   V = std::pow(ArgsV[0], ArgsV[1]); break;
+  default:               V = std::fmod(ArgsV[0], ArgsV[1]);
+  }
+  return true;
+}
+
+// Il corpo viene valutato con i soli parametri visibili
+bool FunctionAST::apply(ConstEval& E, ArrayRef<double> ArgsV, double& V) {
+  const std::vector<symbol>& Params = Proto->getArgs();
+  if (Params.size() != ArgsV.size())
+    return false;
+  size_t frame = E.frame;
+  E.frame = E.Vars.size();
+  for (size_t i = 0; i < Params.size(); i++)
+    E.Vars.emplace_back(Params[i], ArgsV[i]);
+  bool ok = Body->eval(E, V) && !E.jump;
+  E.Vars.resize(E.frame);
+  E.frame = frame;
+  return ok;
+}
+
+// Valuta la chiamata (una sola volta: il risultato resta nel nodo) con i
+// passi rimasti alla funzione corrente
+bool CallExprAST::fold(driver& drv) {
+  if (!Folded) {
+    Folded = 'N';
+    if (drv.eval_steps && drv.EvalFuel) {
+      ConstEval E(drv, std::min(drv.eval_steps, drv.EvalFuel));
+      uint64_t steps = E.steps;
+      if (eval(E, Result))
+        Folded = 'Y';
+      drv.EvalFuel -= steps - E.steps;
+    }
+  }
+  return Folded == 'Y';
+}
+
+bool NumberExprAST::eval(ConstEval& E, double& V) {
+  V = Val;
+  return true;
+}
+
+bool VariableExprAST::eval(ConstEval& E, double& V) {
+  double* P = E.lookup(Name);
+  if (!P)
+    return false;
+  V = *P;
+  return true;
+}
+
+bool BinaryExprAST::eval(ConstEval& E, double& V) {
+  EvalStep S(E);
+  double L, R;
+  if (!S.ok || !LHS->eval(E, L) || !RHS->eval(E, R))
+    return false;
+  switch (Op) {
+  case '+': V = L + R; break;
+  case '-': V = L - R; break;
+  case '*': V = L * R; break;
+  case '/': V = L / R; break;
+  case '%': V = std::fmod(L, R); break;
+  case '<': V = !(L >= R); break;
+  case '=': V = L == R || std::isnan(L) || std::isnan(R); break;
+  default: return false;
+  }
+  return true;
+}
+
+bool CallExprAST::eval(ConstEval& E, double& V) {
+  EvalStep S(E);
+  return S.ok && E.call(Callee, Args, V);
+}
+
+bool IfExprAST::eval(ConstEval& E, double& V) {
+  EvalStep S(E);
+  double C;
+  if (!S.ok || !Cond->eval(E, C))
+    return false;
+  if (C != 0)
+    return TrueExp->eval(E, V);
+  if (FalseExp)
+    return FalseExp->eval(E, V);
+  V = 0;
+  return true;
+}
+
+bool BlockExprAST::eval(ConstEval& E, double& V) {
+  EvalStep S(E);
+  size_t outer = E.Vars.size();
+  bool ok = S.ok;
+  for (size_t i = 0; ok && i < Def.size(); i++) {
+    double D;
+    if ((ok = Def[i]->eval(E, D)))
+      E.Vars.emplace_back(Def[i]->getName(), D);
+  }
+  // Dopo un break o un continue le espressioni successive non sono valutate
+  V = 0;
+  for (size_t i = 0; ok && !E.jump && i < Val.size(); i++)
+    ok = Val[i]->eval(E, V);
+  E.Vars.resize(outer);
+  return ok;
+}
+
+bool VarBindingAST::eval(ConstEval& E, double& V) {
+  EvalStep S(E);
+  return S.ok && Val && Val->eval(E, V);
+}
+
+bool AssignmentExprAST::eval(ConstEval& E, double& V) {
+  EvalStep S(E);
+  if (!S.ok || !Val->eval(E, V))
+    return false;
+  double* P = E.lookup(Name);
+  if (!P)
+    return false;
+  *P = V;
+  return true;
+}
+
+bool ForExprAST::eval(ConstEval& E, double& V) {
+  size_t outer = E.Vars.size();
+  double D;
+  bool ok = Init->eval(E, D);
+  if (ok)
+    if (auto* B = dynamic_cast<VarBindingAST*>(Init))
+      E.Vars.emplace_back(B->getName(), D);
+  while (ok) {
+    EvalStep S(E);
+    double C;
+    if (!(ok = S.ok && CondExp->eval(E, C)) || C == 0)
+      break;
+    ok = Statement->eval(E, D);
+    char jump = E.jump;
+    E.jump = 0;
+    if (!ok || jump == 'B')
+      break;
+    ok = Assignment->eval(E, D);
+  }
+  E.Vars.resize(outer);
+  V = 0;
+  return ok;
+}
+
+bool JumpExprAST::eval(ConstEval& E, double& V) {
+  E.jump = Kind;
+  V = 0;
+  return true;
+}
+
+bool BooleanExprAST::eval(ConstEval& E, double& V) {
+  EvalStep S(E);
+  double L, R = 0;
+  if (!S.ok || !LHS->eval(E, L) || (RHS && !RHS->eval(E, R)))
+    return false;
+  switch (Op) {
+  case 'A': V = L != 0 && R != 0; break;
+  case 'O': V = L != 0 || R != 0; break;
+  case 'N': V = L == 0; break;
+  default: return false;
+  }
+  return true;
+}
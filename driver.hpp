@@ -2,6 +2,7 @@
 #define DRIVER_HPP
 /************************* IR related modules ******************************/
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Function.h"
@@ -9,12 +10,16 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/ProfileSummary.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
 /**************** C++ modules and generic data types ***********************/
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 #include <variant>
@@ -25,58 +30,264 @@ using namespace llvm;
 
 // Dichiarazione del prototipo yylex per Flex
 // Flex va proprio a cercare YY_DECL perché
-// deve espanderla (usando M4) nel punto appropriato
+// deve espanderla (usando M4) nel punto appropriato.
+// Lo scanner è rientrante: il suo stato (yyscan_t, qui void*) è
+// posseduto dal driver e passato esplicitamente ad ogni chiamata
 # define YY_DECL \
-  yy::parser::symbol_type yylex (driver& drv)
-// Per il parser è sufficiente una forward declaration
+  yy::parser::symbol_type yyscan (driver& drv, void* yyscanner)
 YY_DECL;
+// Il parser chiama yylex, che a sua volta chiama lo scanner (yyscan)
+// contando i token e, se richiesto, misurando il tempo di scanning.
+// Per il parser è sufficiente una forward declaration
+yy::parser::symbol_type yylex (driver& drv, void* yyscanner);
+
+// Tempi (in secondi) delle fasi di compilazione e contatori, stampati con
+// -ftime-report (tabella) o -stats-json (JSON, un oggetto per file)
+struct CompileStats {
+  double scan = 0, parse = 0, irgen = 0, verify = 0, optimize = 0, emit = 0;
+  double total = 0;     // Tempo reale complessivo
+  uint64_t tokens = 0, astnodes = 0, functions = 0, instructions = 0;
+  // Picco della memoria residente del processo (KB) al termine del parsing,
+  // della generazione del codice e della compilazione
+  uint64_t rss_parse = 0, rss_codegen = 0, rss = 0;
+  static uint64_t peak_rss ();
+  void merge (const CompileStats& other);
+  void print (raw_ostream& os, StringRef file) const;
+  void print_json (raw_ostream& os, StringRef file) const;
+};
+
+// Cronometro: lap() restituisce i secondi trascorsi dalla chiamata
+// precedente (o dalla creazione)
+class PhaseTimer {
+private:
+  std::chrono::steady_clock::time_point last;
+public:
+  PhaseTimer();
+  double lap();
+};
+
+// Symbol table delle variabili locali con scope annidati. Le associazioni
+// correnti stanno in un vettore indicizzato dall'id del nome, per cui la
+// ricerca è un semplice accesso per indice. Ogni bind sovrascrive la posizione
+// del nome salvando prima nell'undo log il valore precedente; chiudere uno
+// scope significa ripristinare, a ritroso, le voci dell'undo log registrate
+// dopo la sua apertura (il costo è quindi proporzionale ai soli nomi legati)
+class ScopedSymbolTable {
+private:
+  std::vector<AllocaInst*> Bindings;
+  std::vector<std::pair<symbol,AllocaInst*>> UndoLog;
+  std::vector<size_t> Scopes; // Lunghezza dell'undo log all'apertura di ogni scope
+
+public:
+  void grow();                          // Aggiunge la posizione per un nuovo id
+  AllocaInst* lookup(symbol Sym) const;
+  void bind(symbol Sym, AllocaInst* A); // Lega Sym nello scope più interno
+  void push_scope();
+  void pop_scope();
+  void clear();                         // Chiude tutti gli scope aperti
+  std::vector<symbol> visible() const;  // Nomi legati, nell'ordine dei legami
+};
+
+// Profilo di esecuzione letto con -fprofile-use: per ogni funzione i valori
+// dei contatori inseriti da -fprofile-generate (il primo conta gli ingressi
+// nella funzione), sommati su tutte le esecuzioni registrate nel file, e il
+// riassunto dell'intero profilo, che permette a LLVM di distinguere il codice
+// "caldo" da quello "freddo"
+struct ProfileCounts {
+  StringMap<std::vector<uint64_t>> Counts;
+  std::unique_ptr<ProfileSummary> Summary;
+  int load (const std::string& file);
+};
+
+// Pass manager usati per ottimizzare le funzioni, coda fra i thread di
+// parsing e di generazione del codice, stato della generazione iterativa
+// del codice delle espressioni e dell'interprete usato per valutare le
+// chiamate a tempo di compilazione (definiti in driver.cpp)
+struct FunctionOptimizer;
+struct PipelineQueue;
+struct EmitFrame;
+struct ConstEval;
+class FunctionAST;
+namespace llvm { class TargetMachine; }
 
 // Classe che organizza e gestisce il processo di compilazione
 class driver
 {
 public:
   driver();
-  std::map<std::string, AllocaInst*> NamedValues; // Tabella associativa in cui ogni 
-            // chiave x è una variabile e il cui corrispondente valore è un'istruzione 
+  ~driver();
+  // Ogni driver possiede contesto, modulo e builder LLVM propri, per cui
+  // file diversi possono essere compilati in parallelo da driver diversi
+  std::unique_ptr<LLVMContext> context;
+  std::unique_ptr<Module> module;
+  std::unique_ptr<IRBuilder<>> builder;
+  raw_ostream* out;   // Stream su cui viene emesso il codice delle singole
+                      // definizioni (default stderr, nullptr: nessuna emissione)
+  symbol intern (StringRef Name);      // Restituisce l'id (unico) del nome Name
+  StringRef name (symbol Sym) const;   // Restituisce il nome associato all'id Sym
+  StringMap<symbol> SymbolIds;         // Nome -> id, popolata dallo scanner
+  std::vector<StringRef> SymbolNames;  // id -> nome (le chiavi di SymbolIds)
+  // Le tabelle dei simboli seguenti sono vettori indicizzati dall'id del nome
+  // e hanno sempre la stessa lunghezza di SymbolNames
+  ScopedSymbolTable NamedValues; // Per ogni variabile x visibile, l'istruzione 
             // che alloca uno spazio di memoria della dimensione necessaria per 
             // memorizzare un variabile del tipo di x (nel nostro caso solo double)
-  RootAST* root;      // A fine parsing "punta" alla radice dell'AST
+  std::vector<Function*> Functions;     // Funzioni (definite o extern) del modulo
+  std::vector<bool> Defined;            // Funzioni di cui è stato generato il codice
+  std::vector<GlobalVariable*> Globals; // Variabili globali del modulo
+  // Cicli for che racchiudono il punto di generazione corrente, dal più
+  // esterno al più interno: destinazioni di continue (il blocco del passo,
+  // creato solo se serve) e di break (l'uscita dal ciclo, nullptr nel corpo
+  // di un parfor, da cui non si può uscire)
+  struct LoopContext {
+    BasicBlock* StepBB;
+    BasicBlock* ExitBB;
+  };
+  std::vector<LoopContext> Loops;
   int parse (const std::string& f);
+  int parse_string (StringRef text, const std::string& name = "<string>");
   std::string file;
+  StringRef source;   // Testo del programma, se non letto da file (parse_string)
   bool trace_parsing; // Abilita le tracce di debug el parser
-  void scan_begin (); // Implementata nello scanner
+  bool scan_begin (); // Implementata nello scanner
   void scan_end ();   // Implementata nello scanner
+  void* scanner;      // Stato dello scanner rientrante (yyscan_t)
   bool trace_scanning;// Abilita le tracce di debug nello scanner
   yy::location location; // Utillizata dallo scannar per localizzare i token
+  void toplevel (RootAST* item);  // Chiamata dal parser per ogni elemento di primo livello
+  std::vector<RootAST*> Items;    // Elementi in attesa della generazione parallela
   void codegen();
+  unsigned optlevel;  // Livello di ottimizzazione delle funzioni (-O0 ... -O3)
+  unsigned threads;   // Thread usati per generare il codice delle funzioni di un file
+  std::unique_ptr<FunctionOptimizer> optimizer; // Creato alla prima ottimizzazione
+  void optimize (Function& F);
+  std::unique_ptr<TargetMachine> TM; // Creata alla prima richiesta
+  TargetMachine* target ();
+  void optimize_module (unsigned level, bool thinlto = false);
+  int emit (const std::string& outfile, bool summary = false);
+  std::string cachedir; // Directory della cache delle funzioni (vuota: nessuna cache)
+  std::string cache_key (FunctionAST& F);
+  bool cache_lookup (StringRef key, std::string& text);
+  void cache_store (StringRef key, StringRef text);
+  void codegen_parallel ();
+  void import_symbols (const driver& parent);
+  void declare_intrinsic (StringRef name);
+  Function* runtime (StringRef name);  // Funzione del supporto (runtime/)
+  void emit_intrinsics ();
+  bool timing;          // Misura anche i tempi di scanning (-ftime-report, -stats-json)
+  CompileStats Stats;
+  bool pipeline;        // Parsing e generazione del codice su due thread (-pipeline)
+  PipelineQueue* queue; // Nel driver di front-end, la coda verso il generatore
+  int run_parser ();
+  int parse_pipelined ();
+  // Memoizzazione (memo def): tabelle di memo_size posizioni (una potenza di
+  // 2) e, a tabella piena, sostituzione dei risultati (memo_evict)
+  unsigned memo_size;
+  bool memo_evict;
+  void memo_begin (Function* F);
+  void memo_end (Value* RetVal);
+  void memo_print (raw_ostream& os);
+  void memo_discard ();
+  std::vector<GlobalVariable*> MemoGlobals; // Tabelle della funzione corrente
+  std::vector<Value*> MemoKey;              // Chiave (bit degli argomenti)
+  AllocaInst* MemoSlot;                     // Posizione per il risultato
+  // Cicli parfor: i corpi, estratti in funzioni proprie, sono eseguiti in
+  // parallelo dal supporto a tempo di esecuzione (runtime/kparallel.cpp)
+  std::vector<Function*> Outlined;    // Corpi (e task di spawn) estratti dalla funzione corrente
+  unsigned ParDepth;                  // parfor che racchiudono il punto di generazione
+  std::vector<AllocaInst*> ParShared; // Copie delle variabili del chiamante nel corpo
+  // Variabili di riduzione (reduce) dei cicli che racchiudono il punto di
+  // generazione: accumulatore privato del ciclo e operatore
+  struct Reduction {
+    AllocaInst* Acc;
+    char Op;
+  };
+  std::vector<Reduction> Reductions;
+  AllocaInst* Updating;   // Accumulatore di cui si genera l'aggiornamento, o nullptr
+  unsigned UpdateReads;   // Letture di Updating nell'espressione dell'aggiornamento
+  // spawn e sync: contatore dei task generati dalla funzione corrente e non
+  // ancora completati (runtime/ktask.cpp), creato al primo uso
+  AllocaInst* SpawnPending;
+  // Valutazione a tempo di compilazione delle chiamate di funzioni pure con
+  // argomenti costanti. Gli AST delle definizioni pure restano disponibili
+  // (Retained) e ciascuna può essere usata dagli elementi che la seguono
+  // nel sorgente: la posizione di ogni elemento di primo livello ne
+  // stabilisce quindi la visibilità, anche con la generazione parallela
+  uint64_t eval_steps;  // Passi concessi a una chiamata (-eval-steps N, 0: nessuna valutazione)
+  uint64_t eval_fuel;   // Passi concessi alle chiamate di una funzione (-eval-fuel N)
+  uint64_t EvalFuel;    // Passi ancora disponibili nella funzione corrente
+  struct PureDef {
+    FunctionAST* Def;   // Definizione pure del nome, o nullptr
+    size_t Item;        // Posizione della definizione
+  };
+  std::vector<PureDef> PureDefs;
+  std::vector<std::unique_ptr<RootAST>> Retained;
+  size_t ItemCount;     // Elementi di primo livello ricevuti da toplevel
+  size_t CurrentItem;   // Posizione dell'elemento di cui si genera il codice
+  void retain (RootAST* item);          // Conserva item, se è una definizione pure
+  bool retains (RootAST* item) const;
+  // Profilazione. Ogni funzione ha i propri contatori, numerati nell'ordine
+  // in cui la generazione del codice incontra i punti da contare: l'ingresso
+  // nella funzione, i due rami di ogni if, condizione e corpo di ogni for e
+  // ogni chiamata. La numerazione è quindi la stessa con -fprofile-generate
+  // e con -fprofile-use
+  bool profile_generate;          // Inserisce i contatori (-fprofile-generate)
+  const ProfileCounts* profile;   // Profilo in uso (-fprofile-use), o nullptr
+  bool profiling () const { return profile_generate || profile; }
+  void prof_begin (Function* F);  // Inizio della generazione del codice di F
+  void prof_end (Function* F, bool ok);
+  unsigned prof_site (unsigned n = 1); // Riserva n contatori consecutivi
+  void prof_count (unsigned site);     // Incrementa il contatore site
+  uint64_t prof_value (unsigned site) const;
+  MDNode* prof_weights (ArrayRef<uint64_t> counts);
+  void prof_register ();
+  unsigned ProfSites;             // Contatori della funzione corrente
+  GlobalVariable* ProfCounters;   // Segnaposto per l'array dei contatori
+  const std::vector<uint64_t>* ProfValues; // Profilo della funzione corrente
+  std::vector<std::pair<std::string,GlobalVariable*>> ProfPending; // Da registrare
 };
 
-typedef std::variant<std::string,double> lexval;
+typedef std::variant<symbol,double> lexval;
 const lexval NONE = 0.0;
 
 // Classe base dell'intera gerarchia di classi che rappresentano
 // gli elementi del programma
 class RootAST {
 public:
+  static thread_local uint64_t created; // Nodi creati dal thread (statistiche)
+  RootAST() { created++; };
   virtual ~RootAST() {};
   virtual lexval getLexVal() const {return NONE;};
   virtual Value *codegen(driver& drv) { return nullptr; };
+  // Scrive su os una rappresentazione normalizzata del sottoalbero, usata
+  // come chiave della cache delle funzioni compilate
+  virtual void fingerprint(driver& drv, raw_ostream& os) {};
+  // Sposta in Nodes i figli del nodo, che non li possiede più: così i nodi
+  // con figli possono liberare sottoalberi profondi senza ricorsione
+  virtual void release(std::vector<RootAST*>& Nodes) {};
+  // Valuta il nodo con l'interprete E, lasciando il valore in V: false se
+  // il valore non è calcolabile a tempo di compilazione (nodi non gestiti,
+  // globali, chiamate di funzioni non pure, passi esauriti)
+  virtual bool eval(ConstEval& E, double& V) { return false; };
 };
 
-// Classe che rappresenta la sequenza di statement
-class SeqAST : public RootAST {
-private:
-  RootAST* first;
-  RootAST* continuation;
-
+/// ExprAST - Classe base per tutti i nodi espressione
+class ExprAST : public RootAST {
 public:
-  SeqAST(RootAST* first, RootAST* continuation);
-  Value *codegen(driver& drv) override;
+  // Un passo della generazione del codice senza ricorsione: restituisce il
+  // prossimo figlio di cui generare il codice oppure, a nodo completo,
+  // nullptr con il valore in ret (che contiene anche il valore dell'ultimo
+  // figlio). Di default l'intero codice viene generato da codegen
+  virtual ExprAST* step(driver& drv, EmitFrame& F, Value*& ret) {
+    ret = codegen(drv);
+    return nullptr;
+  };
+  // Vero se il codice del nodo (figli compresi) non ha chiamate né effetti
+  // collaterali e non supera Budget nodi, che vengono scalati: un if con
+  // rami di questo tipo diventa una select (si veda IfExprAST::step)
+  virtual bool cheap(unsigned& Budget) const { return false; };
 };
 
-/// ExprAST - Classe base per tutti i nodi espressione
-class ExprAST : public RootAST {};
-
 /// NumberExprAST - Classe per la rappresentazione di costanti numeriche
 class NumberExprAST : public ExprAST {
 private:
@@ -86,17 +297,23 @@ public:
   NumberExprAST(double Val);
   lexval getLexVal() const override;
   Value *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  bool eval(ConstEval& E, double& V) override;
+  bool cheap(unsigned& Budget) const override;
 };
 
 /// VariableExprAST - Classe per la rappresentazione di riferimenti a variabili
 class VariableExprAST : public ExprAST {
 private:
-  std::string Name;
+  symbol Name;
   
 public:
-  VariableExprAST(const std::string &Name);
+  VariableExprAST(symbol Name);
   lexval getLexVal() const override;
   Value *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  bool eval(ConstEval& E, double& V) override;
+  bool cheap(unsigned& Budget) const override;
 };
 
 /// BinaryExprAST - Classe per la rappresentazione di operatori binari
@@ -108,19 +325,32 @@ private:
 
 public:
   BinaryExprAST(char Op, ExprAST* LHS, ExprAST* RHS);
+  ~BinaryExprAST();
   Value *codegen(driver& drv) override;
+  ExprAST* step(driver& drv, EmitFrame& F, Value*& ret) override;
+  void release(std::vector<RootAST*>& Nodes) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  bool eval(ConstEval& E, double& V) override;
+  bool cheap(unsigned& Budget) const override;
 };
 
 /// CallExprAST - Classe per la rappresentazione di chiamate di funzione
 class CallExprAST : public ExprAST {
 private:
-  std::string Callee;
+  symbol Callee;
   std::vector<ExprAST*> Args;  // ASTs per la valutazione degli argomenti
+  char Folded;                 // Valutazione a tempo di compilazione: da
+                               // tentare (0), riuscita ('Y') o no ('N')
+  double Result;               // Valore della chiamata, se Folded è 'Y'
 
 public:
-  CallExprAST(std::string Callee, std::vector<ExprAST*> Args);
+  CallExprAST(symbol Callee, std::vector<ExprAST*> Args);
+  ~CallExprAST();
   lexval getLexVal() const override;
   Value *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  bool eval(ConstEval& E, double& V) override;
+  bool fold(driver& drv);
 };
 
 /// IfExprAST - Classe per la rappresentazione di espressioni condizionali
@@ -131,7 +361,13 @@ private:
   ExprAST* FalseExp;
 public:
   IfExprAST(ExprAST* Cond, ExprAST* TrueExp, ExprAST* FalseExp=nullptr);
+  ~IfExprAST();
   Value *codegen(driver& drv) override;
+  ExprAST* step(driver& drv, EmitFrame& F, Value*& ret) override;
+  void release(std::vector<RootAST*>& Nodes) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  bool eval(ConstEval& E, double& V) override;
+  bool cheap(unsigned& Budget) const override;
 };
 
 /// BlockExprAST - Classe per la rappresentazione di blocchi di codice
@@ -141,18 +377,26 @@ private:
   std::vector<ExprAST*> Val;
 public:
   BlockExprAST(std::vector<VarBindingAST*> Def, std::vector<ExprAST*> Val);
+  ~BlockExprAST();
   Value *codegen(driver& drv) override;
+  ExprAST* step(driver& drv, EmitFrame& F, Value*& ret) override;
+  void release(std::vector<RootAST*>& Nodes) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  bool eval(ConstEval& E, double& V) override;
 }; 
 
 /// VarBindingAST - Classe per la rappresentazione di dichiarazioni di variabili
 class VarBindingAST: public RootAST {
 private:
-  const std::string Name;
+  const symbol Name;
   ExprAST* Val;
 public:
-  VarBindingAST(const std::string Name, ExprAST* Val);
+  VarBindingAST(symbol Name, ExprAST* Val);
+  ~VarBindingAST();
   AllocaInst *codegen(driver& drv) override;
-  const std::string& getName() const;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  bool eval(ConstEval& E, double& V) override;
+  symbol getName() const;
 };
 
 /// PrototypeAST - Classe per la rappresentazione dei prototipi di funzione
@@ -160,16 +404,22 @@ public:
 /// perché unico)
 class PrototypeAST : public RootAST {
 private:
-  std::string Name;
-  std::vector<std::string> Args;
+  symbol Name;
+  std::vector<symbol> Args;
   bool emitcode;
+  unsigned Attrs;
 
 public:
-  PrototypeAST(std::string Name, std::vector<std::string> Args);
-  const std::vector<std::string> &getArgs() const;
+  // Annotazioni della funzione (pure def, extern pure, inline def)
+  enum { Pure = 1, Inline = 2, Memo = 4 };
+  PrototypeAST(symbol Name, std::vector<symbol> Args);
+  const std::vector<symbol> &getArgs() const;
   lexval getLexVal() const override;
   Function *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
   void noemit();
+  void setAttrs(unsigned A);
+  unsigned getAttrs() const;
 };
 
 /// FunctionAST - Classe che rappresenta la definizione di una funzione
@@ -181,7 +431,11 @@ private:
   
 public:
   FunctionAST(PrototypeAST* Proto, ExprAST* Body);
+  ~FunctionAST();
   Function *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  bool apply(ConstEval& E, ArrayRef<double> ArgsV, double& V);
+  PrototypeAST* getProto() const;
 };
 
 
@@ -190,22 +444,27 @@ public:
 /// GlobalAST - Classe per la rappresentazione di variabili globali
 class GlobalAST : public RootAST {
 private:
-  const std::string Name;
+  const symbol Name;
+  const bool ThreadLocal; // Una copia per thread (threadlocal global)
 
 public:
-  GlobalAST(std::string Name);
+  GlobalAST(symbol Name, bool ThreadLocal = false);
   Value *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
 };
 
 /// AssignmentExprAST - Classe per la rappresentazione di assegnamenti
 class AssignmentExprAST : public ExprAST {
 private:
-  std::string Name;
+  symbol Name;
   ExprAST* Val;
 
 public:
-  AssignmentExprAST(std::string Name, ExprAST* Val);
-  Value *codegen(driver& dvr) override;
+  AssignmentExprAST(symbol Name, ExprAST* Val);
+  ~AssignmentExprAST();
+  Value *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  bool eval(ConstEval& E, double& V) override;
 };
 
 /// ForExprAST - Classe per la rappresentazione di cicli for
@@ -218,8 +477,77 @@ class ForExprAST : public ExprAST {
 
   public:
     ForExprAST(RootAST* Init, ExprAST* CondExp, AssignmentExprAST* Assignment, ExprAST* Statement);
+    ~ForExprAST();
     Value *codegen(driver& drv) override;
+    void fingerprint(driver& drv, raw_ostream& os) override;
+    bool eval(ConstEval& E, double& V) override;
+    void setReductions(ReductionList R);
+
+  private:
+    ReductionList Reductions;
+
+};
+
+/// ParForExprAST - Classe per la rappresentazione di cicli parfor, con
+/// variabile Var da Start (compreso) a Bound (escluso) con passo Step; la
+/// condizione e il passo devono usare Var (CondVar e StepVar)
+class ParForExprAST : public ExprAST {
+private:
+  symbol Var;
+  ExprAST* Start;
+  symbol CondVar;
+  ExprAST* Bound;
+  symbol StepVar;
+  ExprAST* Step;
+  ExprAST* Statement;
+  ReductionList Reductions;
+
+public:
+  ParForExprAST(symbol Var, ExprAST* Start, symbol CondVar, ExprAST* Bound,
+                symbol StepVar, ExprAST* Step, ExprAST* Statement);
+  ~ParForExprAST();
+  Value *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  void setReductions(ReductionList R);
+};
 
+/// SpawnExprAST - Classe per la rappresentazione di spawn f(args) e di
+/// x = spawn f(args): una chiamata eseguita come task, eventualmente da un
+/// altro thread, il cui risultato è disponibile in x dopo sync
+class SpawnExprAST : public ExprAST {
+private:
+  bool Assigns;                // Il risultato va assegnato a Dest
+  symbol Dest;
+  symbol Callee;
+  std::vector<ExprAST*> Args;
+
+public:
+  SpawnExprAST(symbol Callee, std::vector<ExprAST*> Args);
+  SpawnExprAST(symbol Dest, symbol Callee, std::vector<ExprAST*> Args);
+  ~SpawnExprAST();
+  Value *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+};
+
+/// SyncExprAST - Classe per la rappresentazione di sync, che attende i
+/// task generati dalla funzione
+class SyncExprAST : public ExprAST {
+public:
+  Value *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+};
+
+/// JumpExprAST - Classe per la rappresentazione di break ('B') e continue
+/// ('C') nel corpo di un ciclo for
+class JumpExprAST : public ExprAST {
+private:
+  char Kind;
+
+public:
+  JumpExprAST(char Kind);
+  Value *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  bool eval(ConstEval& E, double& V) override;
 };
 
 /// BooleanExprAST - Classe per la rappresentazione di espressioni booleane
@@ -231,7 +559,11 @@ private:
 
 public:
   BooleanExprAST(char Op, ExprAST* LHS, ExprAST* RHS=nullptr);
+  ~BooleanExprAST();
   Value *codegen(driver& drv) override;
+  void fingerprint(driver& drv, raw_ostream& os) override;
+  bool eval(ConstEval& E, double& V) override;
+  bool cheap(unsigned& Budget) const override;
 };
 
 #endif // ! DRIVER_HH
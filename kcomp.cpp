@@ -1,24 +1,245 @@
+#include <atomic>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include "driver.hpp"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
 
-extern LLVMContext *context;
-extern Module *module;
-extern IRBuilder<> *builder;
+// Opzioni da riga di comando, comuni a tutti i file da compilare
+static bool trace_parsing = false;  // Abilita tracce debug nel parser
+static bool trace_scanning = false; // Abilita tracce debug nello scanner
+static unsigned optlevel = 0;       // Livello di ottimizzazione (-O0 ... -O3)
+static unsigned threads = 1;        // Thread di generazione del codice per file (-t N)
+static std::string cachedir;        // Cache delle funzioni compilate (-cache DIR)
+static bool time_report = false;    // Tabella dei tempi delle fasi su stdout (-ftime-report)
+static bool stats_json = false;     // Tempi e contatori in JSON su stdout (-stats-json)
+static std::mutex report_lock;      // Serializza i report dei thread di -j
+static bool whole_program = false;  // Tutti i file in un unico modulo (--whole-program)
+static std::string outfile;         // File di output di --whole-program (-o FILE)
+static bool lto_thin = false;       // Bitcode con summary per il link ThinLTO (-flto=thin)
+static unsigned jobs = 0;           // File compilati in parallelo (-j N, 0: sequenziale)
+static bool profile_generate = false; // Codice con contatori (-fprofile-generate)
+static unsigned memo_size = 1024;   // Posizioni delle tabelle di memo def (-memo-size N)
+static bool memo_evict = true;      // Sostituzione a tabella piena (-memo-evict=home|none)
+static uint64_t eval_steps = 1000000;  // Passi per valutare una chiamata (-eval-steps N)
+static uint64_t eval_fuel = 10000000;  // Passi per le chiamate di una funzione (-eval-fuel N)
+static bool pipeline = false;       // Parsing e generazione del codice in pipeline (-pipeline)
+static std::string profile_use;     // File del profilo da usare (-fprofile-use=FILE)
+static ProfileCounts profile;       // Profilo letto, condiviso da tutti i driver
 
-int main (int argc, char *argv[]) {
+// Compila il file f con un driver (e quindi contesto, modulo e builder LLVM)
+// dedicato. Il codice viene emesso su out
+static void configure (driver& drv) {
+  drv.trace_parsing = trace_parsing;
+  drv.trace_scanning = trace_scanning;
+  drv.optlevel = optlevel;
+  drv.threads = threads;
+  drv.cachedir = cachedir;
+  drv.timing = time_report || stats_json;
+  drv.pipeline = pipeline;
+  drv.memo_size = memo_size;
+  drv.memo_evict = memo_evict;
+  drv.eval_steps = eval_steps;
+  drv.eval_fuel = eval_fuel;
+  drv.profile_generate = profile_generate;
+  if (!profile_use.empty())
+    drv.profile = &profile;
+}
+
+// I report vanno su stdout, dato che stderr riceve (di default) il codice
+static void report (driver& drv, StringRef name) {
+  if (!drv.timing)
+    return;
+  std::lock_guard<std::mutex> lock(report_lock);
+  if (time_report)
+    drv.Stats.print(outs(), name);
+  if (stats_json)
+    drv.Stats.print_json(outs(), name);
+  outs().flush();
+}
+
+static int compile (const std::string& f, raw_ostream& out) {
+  PhaseTimer T;
+  driver drv;
+  configure(drv);
+  drv.out = &out;
+  if (drv.parse(f))  // Parsing e creazione dell'AST
+    return 1;
+  drv.codegen();     // Visita AST e generazione dell'IR
+  drv.Stats.total = T.lap();
+  drv.Stats.rss = CompileStats::peak_rss();
+  report(drv, f);
+  return 0;
+}
+
+// Compilazione "whole program": tutti i file vengono tradotti, in ordine,
+// nello stesso modulo, per cui i prototipi extern di un file si risolvono
+// nelle definizioni presenti negli altri. Il modulo viene poi ottimizzato
+// per intero (di default a livello 2), così che l'inlining e le altre
+// ottimizzazioni interprocedurali possano attraversare i confini fra file,
+// ed emesso in outfile (su stderr come IR se outfile non è specificato)
+static int compile_whole_program (const std::vector<std::string>& files) {
+  PhaseTimer T;
+  driver drv;
+  configure(drv);
+  drv.optlevel = 0;   // Le funzioni sono ottimizzate insieme, alla fine
+  drv.threads = 1;
+  drv.cachedir.clear();
+  drv.out = nullptr;
+  for (auto& f : files) {
+    if (drv.parse(f))
+      return 1;
+    drv.codegen();
+  }
+  drv.optimize_module(optlevel ? optlevel : 2);
   int res = 0;
+  if (outfile.empty())
+    drv.module->print(errs(), nullptr);
+  else
+    res = drv.emit(outfile);
+  drv.Stats.total = T.lap();
+  drv.Stats.rss = CompileStats::peak_rss();
+  report(drv, outfile.empty() ? "<whole-program>" : outfile);
+  return res;
+}
+
+// Compilazione per il link ThinLTO: il modulo del file f viene ottimizzato
+// con la pipeline che precede il link e scritto, insieme al suo summary,
+// nel file omonimo con suffisso .bc. Il link (ad esempio clang++ -flto=thin
+// -fuse-ld=lld) importa poi fra i moduli le funzioni più convenienti da
+// espandere inline, in parallelo e con una cache incrementale
+static int compile_thin (const std::string& f) {
+  PhaseTimer T;
   driver drv;
+  configure(drv);
+  drv.optlevel = 0;
+  drv.threads = 1;
+  drv.cachedir.clear();
+  drv.out = nullptr;
+  // ThinLTO ricava gli identificatori dei simboli locali (ad esempio
+  // __kprof_init) dal nome del sorgente, che deve quindi essere diverso
+  // per ogni modulo
+  drv.module->setSourceFileName(f);
+  drv.module->setModuleIdentifier(f);
+  if (drv.parse(f))
+    return 1;
+  drv.codegen();
+  drv.optimize_module(optlevel ? optlevel : 2, true);
+  SmallString<128> outname(f);
+  sys::path::replace_extension(outname, "bc");
+  int res = drv.emit(std::string(outname), true);
+  drv.Stats.total = T.lap();
+  drv.Stats.rss = CompileStats::peak_rss();
+  report(drv, f);
+  return res;
+}
+
+// Compila il file f scrivendo il codice nel file omonimo con suffisso .ll
+static int compile_to_file (const std::string& f) {
+  SmallString<128> outname(f);
+  sys::path::replace_extension(outname, "ll");
+  std::error_code EC;
+  raw_fd_ostream out(outname, EC, sys::fs::OF_Text);
+  if (EC) {
+    std::cerr << "cannot open " << outname.c_str() << ": " << EC.message() << '\n';
+    return 1;
+  }
+  return compile(f, out);
+}
+
+// Compilazione di un singolo file secondo le opzioni
+static int compile_unit (const std::string& f) {
+  if (lto_thin)
+    return compile_thin(f);
+  if (jobs)
+    return compile_to_file(f);
+  return compile(f, errs());
+}
+
+int main (int argc, char *argv[]) {
+  std::vector<std::string> files;
   int i = 1;
   while (i<argc) {
     if (argv[i] == std::string ("-p"))
-      drv.trace_parsing = true; // Abilita tracce debug nel parser
+      trace_parsing = true;
     else if (argv[i] == std::string ("-s"))
-      drv.trace_scanning = true;// Abilita tracce debug nello scanner
-    else  if (!drv.parse(argv[i])) { // Parsing e creazione dell'AST
-      drv.codegen();                 // Visita AST e generazione dell'IR (su stderr)
-    } else
-      res = 1;
+      trace_scanning = true;
+    else if (argv[i] == std::string ("-j") && i+1<argc)
+      jobs = std::max(1, atoi(argv[++i]));
+    else if (argv[i] == std::string ("-t") && i+1<argc)
+      threads = std::max(1, atoi(argv[++i]));
+    else if (argv[i] == std::string ("-cache") && i+1<argc)
+      cachedir = argv[++i];
+    else if (argv[i] == std::string ("-ftime-report"))
+      time_report = true;
+    else if (argv[i] == std::string ("-stats-json"))
+      stats_json = true;
+    else if (argv[i] == std::string ("--whole-program"))
+      whole_program = true;
+    else if (argv[i] == std::string ("-o") && i+1<argc)
+      outfile = argv[++i];
+    else if (argv[i] == std::string ("-flto=thin"))
+      lto_thin = true;
+    else if (argv[i] == std::string ("-memo-size") && i+1<argc)
+      memo_size = PowerOf2Ceil(std::max(1, atoi(argv[++i])));
+    else if (argv[i] == std::string ("-memo-evict=home"))
+      memo_evict = true;
+    else if (argv[i] == std::string ("-memo-evict=none"))
+      memo_evict = false;
+    else if (argv[i] == std::string ("-eval-steps") && i+1<argc)
+      eval_steps = strtoull(argv[++i], nullptr, 10);
+    else if (argv[i] == std::string ("-eval-fuel") && i+1<argc)
+      eval_fuel = strtoull(argv[++i], nullptr, 10);
+    else if (argv[i] == std::string ("-pipeline"))
+      pipeline = true;
+    else if (argv[i] == std::string ("-fprofile-generate"))
+      profile_generate = true;
+    else if (StringRef(argv[i]).startswith("-fprofile-use="))
+      profile_use = argv[i] + strlen("-fprofile-use=");
+    else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '3')
+      optlevel = argv[i][2] - '0';
+    else
+      files.push_back(argv[i]);
     i++;
   };
+
+  if (!cachedir.empty())
+    if (std::error_code EC = sys::fs::create_directories(cachedir)) {
+      std::cerr << "cannot create " << cachedir << ": " << EC.message() << '\n';
+      return 1;
+    }
+
+  if (!profile_use.empty() && profile.load(profile_use))
+    return 1;
+
+  if (whole_program)
+    return compile_whole_program(files);
+  if (!outfile.empty()) {
+    std::cerr << "-o richiede --whole-program\n";
+    return 1;
+  }
+
+  if (!jobs) {
+    int res = 0;
+    for (auto& f : files)
+      res |= compile_unit(f);
+    return res;
+  }
+
+  // Con -j N i file vengono distribuiti fra N thread: ogni thread preleva
+  // il prossimo file non ancora compilato e ne scrive il codice in f.ll
+  // (o f.bc con -flto=thin)
+  std::atomic<size_t> next(0);
+  std::atomic<int> res(0);
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < std::min<size_t>(jobs, files.size()); t++)
+    pool.emplace_back([&] {
+      for (size_t k = next++; k < files.size(); k = next++)
+        if (compile_unit(files[k]))
+          res = 1;
+    });
+  for (auto& t : pool)
+    t.join();
   return res;
 }
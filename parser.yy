@@ -9,7 +9,14 @@
 
 %code requires {
   # include <string>
+  # include <cstdint>
+  # include <vector>
   #include <exception>
+  // Identificatore di un nome (variabile, funzione, globale) internato
+  // dal driver: i nodi dell'AST lo portano al posto della stringa
+  typedef uint32_t symbol;
+  // Clausole reduce di un ciclo: operatore ('+' o '*') e variabile
+  typedef std::vector<std::pair<char,symbol>> ReductionList;
   class driver;
   class RootAST;
   class ExprAST;
@@ -17,19 +24,23 @@
   class VariableExprAST;
   class CallExprAST;
   class FunctionAST;
-  class SeqAST;
   class PrototypeAST;
   class BlockExprAST;
   class VarBindingAST;
   class GlobalAST;
   class AssignmentExprAST;
   class ForExprAST;
+  class ParForExprAST;
+  class SpawnExprAST;
   class IfExprAST;
   class BooleanExprAST;
+  class JumpExprAST;
 }
 
 // The parsing context.
 %param { driver& drv }
+// Lo stato dello scanner rientrante, passato a yylex
+%param { void* yyscanner }
 
 %locations
 
@@ -49,6 +60,7 @@
   PLUS       "+"
   STAR       "*"
   SLASH      "/"
+  PERCENT    "%"
   LPAREN     "("
   RPAREN     ")"
   QMARK	     "?"
@@ -65,12 +77,22 @@
   IF         "if"
   ELSE       "else"
   FOR        "for"
+  PARFOR     "parfor"
+  REDUCE     "reduce"
+  BREAK      "break"
+  CONTINUE   "continue"
+  PURE       "pure"
+  INLINE     "inline"
+  MEMO       "memo"
+  THREADLOCAL "threadlocal"
+  SPAWN      "spawn"
+  SYNC       "sync"
   AND        "and"
   OR         "or"
   NOT        "not" 
 ;
 
-%token <std::string> IDENTIFIER "id"
+%token <symbol> IDENTIFIER "id"
 %token <double> NUMBER "number"
 %type <ExprAST*> exp
 %type <ExprAST*> idexp
@@ -80,12 +102,13 @@
 %type <ExprAST*> stmt
 %type <std::vector<ExprAST*>> optexp
 %type <std::vector<ExprAST*>> explist
-%type <RootAST*> program
 %type <RootAST*> top
 %type <FunctionAST*> definition
 %type <PrototypeAST*> external
 %type <PrototypeAST*> proto
-%type <std::vector<std::string>> idseq
+%type <int> fnattrs
+%type <int> fnattr
+%type <std::vector<symbol>> idseq
 %type <BlockExprAST*> block
 %type <std::vector<VarBindingAST*>> vardefs
 %type <VarBindingAST*> binding
@@ -95,6 +118,10 @@
 %type <RootAST*> init
 %type <IfExprAST*> ifstmt
 %type <ForExprAST*> forstmt
+%type <ParForExprAST*> parforstmt
+%type <SpawnExprAST*> spawnstmt
+%type <std::pair<symbol,ExprAST*>> parstep
+%type <ReductionList> reductions
 %type <ExprAST*> condexp
 
 
@@ -102,11 +129,13 @@
 %start startsymb;
 
 startsymb:
-  program                 { drv.root = $1; }
+  program;
 
+// Ogni elemento di primo livello viene passato al driver appena riconosciuto
+// (la ricorsione a sinistra fa sì che la riduzione avvenga subito)
 program:
-  %empty                { $$ = new SeqAST(nullptr,nullptr); }
-|  top ";" program      { $$ = new SeqAST($1,$3); };
+  %empty
+| program top ";"       { drv.toplevel($2); };
 
 top:
 %empty                  { $$ = nullptr; }
@@ -115,25 +144,37 @@ top:
 | globalvar             { $$ = $1; };
 
 definition:
-  "def" proto block      { $$ = new FunctionAST($2,$3); $2->noemit(); };  
+  "def" proto block      { $$ = new FunctionAST($2,$3); $2->noemit(); }
+| fnattrs "def" proto block { $3->setAttrs($1); $$ = new FunctionAST($3,$4); $3->noemit(); };
   
+fnattrs:
+  fnattr                { $$ = $1; }
+| fnattrs fnattr        { $$ = $1 | $2; };
+
+fnattr:
+  "pure"                { $$ = PrototypeAST::Pure; }
+| "inline"              { $$ = PrototypeAST::Inline; }
+| "memo"                { $$ = PrototypeAST::Memo | PrototypeAST::Pure; };
+
 external:
-  "extern" proto        { $$ = $2; };
+  "extern" proto        { $$ = $2; }
+| "extern" "pure" proto { $3->setAttrs(PrototypeAST::Pure); $$ = $3; };
 
 proto:
   "id" "(" idseq ")"    { $$ = new PrototypeAST($1,$3); };
 
 globalvar:
-  "global" "id"         { $$ = new GlobalAST($2);};
+  "global" "id"         { $$ = new GlobalAST($2);}
+| "threadlocal" "global" "id" { $$ = new GlobalAST($3,true);};
 
 idseq:
-  %empty                { std::vector<std::string> args; $$ = args; }
+  %empty                { std::vector<symbol> args; $$ = args; }
 | "id" idseq            { $2.insert($2.begin(),$1); $$ = $2; };
 
 %left ":";
 %left "<" "==";
 %left "+" "-";
-%left "*" "/";
+%left "*" "/" "%";
 
 %left "not";
 %left "and" "or";
@@ -147,6 +188,11 @@ stmt:
 | block                 { $$ = $1; }
 | ifstmt                { $$ = $1; }
 | forstmt               { $$ = $1; }
+| parforstmt            { $$ = $1; }
+| spawnstmt             { $$ = $1; }
+| "sync"                { $$ = new SyncExprAST(); }
+| "break"               { $$ = new JumpExprAST('B'); }
+| "continue"            { $$ = new JumpExprAST('C'); }
 | exp                   { $$ = $1; };
 
 ifstmt:
@@ -154,7 +200,26 @@ ifstmt:
 | "if" "(" condexp ")" stmt "else" stmt { $$ = new IfExprAST($3,$5,$7); };
 
 forstmt:
-  "for" "(" init ";" condexp ";" assignment ")" stmt { $$ = new ForExprAST($3,$5,$7,$9);};
+  "for" "(" init ";" condexp ";" assignment ")" reductions stmt
+                        { $$ = new ForExprAST($3,$5,$7,$10); $$->setReductions($9); };
+
+parforstmt:
+  "parfor" "(" "var" "id" "=" exp ";" "id" "<" exp ";" parstep ")" reductions stmt
+                        { $$ = new ParForExprAST($4,$6,$8,$10,$12.first,$12.second,$15); $$->setReductions($14); };
+
+parstep:
+  "+" "+" "id"          { $$ = std::make_pair($3, (ExprAST*) new NumberExprAST(1.0)); }
+| "id" "=" "id" "+" exp { if ($1 != $3) { delete $5; error(@$, "il passo di parfor deve incrementare la variabile del ciclo"); YYERROR; }
+                          $$ = std::make_pair($1, $5); };
+
+spawnstmt:
+  "spawn" "id" "(" optexp ")"          { $$ = new SpawnExprAST($2,$4); }
+| "id" "=" "spawn" "id" "(" optexp ")" { $$ = new SpawnExprAST($1,$4,$6); };
+
+reductions:
+  %empty                { }
+| reductions "reduce" "(" "+" ":" "id" ")" { $1.push_back({'+', $6}); $$ = $1; }
+| reductions "reduce" "(" "*" ":" "id" ")" { $1.push_back({'*', $6}); $$ = $1; };
 
 init:
   binding     { $$ = $1; }
@@ -180,6 +245,7 @@ exp:
 | exp "-" exp           { $$ = new BinaryExprAST('-',$1,$3); }
 | exp "*" exp           { $$ = new BinaryExprAST('*',$1,$3); }
 | exp "/" exp           { $$ = new BinaryExprAST('/',$1,$3); }
+| exp "%" exp           { $$ = new BinaryExprAST('%',$1,$3); }
 | idexp                 { $$ = $1; }
 | "(" exp ")"           { $$ = $2; }
 | "number"              { $$ = new NumberExprAST($1); }
@@ -0,0 +1,125 @@
+// Supporto a tempo di esecuzione per i cicli parfor, da collegare insieme
+// al programma (con -pthread). kcomp estrae il corpo di ogni parfor in una
+// funzione body(lo, hi, env), che esegue le iterazioni di indice [lo, hi),
+// e lo passa con il numero n delle iterazioni a __kpar_for. Le iterazioni
+// sono divise in blocchi, e ogni partecipante (i thread del pool e il
+// chiamante) riceve un intervallo contiguo di blocchi, che consuma in
+// ordine; esaurito il proprio intervallo ruba i blocchi rimasti a quelli
+// degli altri, per cui iterazioni di durata diversa restano bilanciate.
+// Il pool (di KPAR_THREADS thread, di default uno per core, compreso il
+// chiamante) viene creato al primo ciclo. Un parfor eseguito nel corpo di
+// un altro, o mentre un altro thread ne esegue uno, è sequenziale
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef void (*Body)(int64_t lo, int64_t hi, double* env);
+
+// Blocchi di un partecipante: next è il prossimo da eseguire, per lui o
+// per chi ruba (su linee di cache distinte)
+struct alignas(64) Range {
+  std::atomic<int64_t> next;
+  int64_t end;
+};
+
+thread_local bool inside = false;  // Il thread sta eseguendo un corpo
+
+struct Pool {
+  unsigned size;                   // Partecipanti, compreso il chiamante
+  std::unique_ptr<Range[]> ranges;
+  std::mutex busy;                 // Un ciclo parallelo alla volta
+  std::mutex lock;
+  std::condition_variable start, done;
+  uint64_t generation = 0;         // Cicli avviati
+  unsigned running = 0;            // Thread del pool non ancora terminati
+  Body body;
+  double* env;
+  int64_t n, chunk;
+
+  Pool() {
+    const char* s = getenv("KPAR_THREADS");
+    size = s ? atoi(s) : std::thread::hardware_concurrency();
+    size = std::max(size, 1u);
+    ranges.reset(new Range[size]);
+    for (unsigned t = 1; t < size; t++)
+      std::thread([this, t] { worker(t); }).detach();
+  }
+
+  void work(unsigned self) {
+    for (unsigned k = 0; k < size; k++) {
+      Range& r = ranges[(self + k) % size];
+      for (int64_t c; (c = r.next.fetch_add(1, std::memory_order_relaxed)) < r.end; )
+        body(c * chunk, std::min(n, (c + 1) * chunk), env);
+    }
+  }
+
+  void worker(unsigned self) {
+    inside = true;
+    uint64_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> l(lock);
+        start.wait(l, [&] { return generation != seen; });
+        seen = generation;
+      }
+      work(self);
+      std::lock_guard<std::mutex> l(lock);
+      if (--running == 0)
+        done.notify_one();
+    }
+  }
+};
+
+// Il pool non viene mai distrutto: i suoi thread restano in attesa fino
+// alla fine del programma
+Pool& pool() {
+  static Pool* P = new Pool;
+  return *P;
+}
+
+}
+
+extern "C" void __kpar_for(Body body, double* env, int64_t n) {
+  if (n <= 0)
+    return;
+  if (inside || n == 1) {
+    body(0, n, env);
+    return;
+  }
+  Pool& P = pool();
+  if (P.size == 1 || !P.busy.try_lock()) {
+    body(0, n, env);
+    return;
+  }
+  // Circa 8 blocchi per partecipante
+  P.body = body;
+  P.env = env;
+  P.n = n;
+  P.chunk = std::max<int64_t>(1, n / (8 * P.size));
+  int64_t chunks = (n + P.chunk - 1) / P.chunk;
+  for (unsigned t = 0; t < P.size; t++) {
+    P.ranges[t].next.store(chunks * t / P.size, std::memory_order_relaxed);
+    P.ranges[t].end = chunks * (t + 1) / P.size;
+  }
+  {
+    std::lock_guard<std::mutex> l(P.lock);
+    P.running = P.size - 1;
+    P.generation++;
+  }
+  P.start.notify_all();
+  inside = true;
+  P.work(0);
+  inside = false;
+  std::unique_lock<std::mutex> l(P.lock);
+  P.done.wait(l, [&] { return P.running == 0; });
+  l.unlock();
+  P.busy.unlock();
+}
@@ -0,0 +1,53 @@
+// Supporto a tempo di esecuzione per i programmi compilati con
+// kcomp -fprofile-generate, da collegare insieme al programma.
+// Il costruttore di ogni modulo registra gli array dei contatori delle sue
+// funzioni; al termine del programma i valori vengono accodati al file
+// indicato dalla variabile d'ambiente KPROF_FILE (default.kprof se non
+// definita), una riga per funzione: nome, numero dei contatori e valori.
+// Più esecuzioni accumulano quindi le proprie righe nello stesso file, e
+// kcomp -fprofile-use=FILE le somma
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+struct Counters {
+  const char* name;
+  uint64_t* counts;
+  uint64_t n;
+};
+
+// Il registro è costruito alla prima registrazione, che avviene durante
+// l'inizializzazione del programma, prima di main
+std::vector<Counters>& registry() {
+  static std::vector<Counters> R;
+  return R;
+}
+
+void dump() {
+  const char* path = getenv("KPROF_FILE");
+  if (!path)
+    path = "default.kprof";
+  FILE* f = fopen(path, "a");
+  if (!f) {
+    perror(path);
+    return;
+  }
+  for (auto& c : registry()) {
+    fprintf(f, "%s %llu", c.name, (unsigned long long) c.n);
+    for (uint64_t i = 0; i < c.n; i++)
+      fprintf(f, " %llu", (unsigned long long) c.counts[i]);
+    fprintf(f, "\n");
+  }
+  fclose(f);
+}
+
+}
+
+extern "C" void __kprof_register(const char* name, uint64_t* counts, uint64_t n) {
+  if (registry().empty())
+    atexit(dump);
+  registry().push_back({name, counts, n});
+}
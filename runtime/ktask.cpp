@@ -0,0 +1,263 @@
+// Supporto a tempo di esecuzione per spawn e sync, da collegare insieme al
+// programma (con -pthread). Per x = spawn f(args) kcomp genera una funzione
+// fn(args, result) che esegue la chiamata e ne scrive il risultato in x (per
+// spawn f(args), senza assegnamento, result è nullo e fn non lo scrive), e
+// la passa a __kspawn insieme al contatore dei task pendenti della funzione
+// chiamante, che __ksync attende sia azzerato. Ogni thread del pool
+// (KPAR_THREADS, di default uno per core, compreso il primo thread esterno
+// che esegue uno spawn) possiede un deque di Chase e Lev: i task generati
+// sono inseriti in fondo e, da chi li ha generati, estratti dal fondo (in
+// ordine LIFO, per la località), mentre i thread senza lavoro li rubano
+// dalla cima, dove si trovano i task più vecchi e quindi, nel divide et
+// impera, i più grandi. Chi attende in __ksync esegue intanto altri task.
+// Un task di profondità almeno KPAR_CUTOFF (di default log2 dei thread più
+// 4) viene eseguito subito, come una chiamata, così come quelli generati da
+// thread esterni al pool diversi dal primo
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+typedef void (*Fn)(double* args, double* result);
+
+// Task generato da spawn, seguito in memoria dalla copia degli argomenti
+struct Task {
+  Fn fn;
+  double* result;
+  std::atomic<int64_t>* pending;  // Contatore della funzione che l'ha generato
+  unsigned depth;                 // Spawn annidati che l'hanno generato
+  double* args() { return reinterpret_cast<double*>(this + 1); }
+};
+
+// Deque di Chase e Lev, con gli ordinamenti della versione per modelli di
+// memoria deboli (Lê, Pop, Cohen, Zappa Nardelli, PPoPP 2013): il
+// proprietario inserisce ed estrae in fondo (bottom) senza sincronizzarsi
+// con gli altri, salvo che per l'ultimo task rimasto, mentre i ladri
+// estraggono dalla cima (top) con un compare-and-swap. L'array circolare
+// raddoppia quando è pieno; i precedenti, che un ladro potrebbe ancora
+// leggere, sono liberati solo con il deque
+class Deque {
+  struct Array {
+    int64_t size;  // Una potenza di 2
+    std::unique_ptr<std::atomic<Task*>[]> buf;
+    Array(int64_t size) : size(size), buf(new std::atomic<Task*>[size]) {}
+    Task* get(int64_t i) { return buf[i & (size - 1)].load(std::memory_order_relaxed); }
+    void put(int64_t i, Task* t) { buf[i & (size - 1)].store(t, std::memory_order_relaxed); }
+  };
+  alignas(64) std::atomic<int64_t> top{0};
+  alignas(64) std::atomic<int64_t> bottom{0};
+  std::atomic<Array*> array;
+  std::vector<std::unique_ptr<Array>> arrays;  // Allocati dal proprietario
+
+public:
+  Deque() {
+    arrays.emplace_back(new Array(64));
+    array.store(arrays.back().get(), std::memory_order_relaxed);
+  }
+
+  // Solo il proprietario
+  void push(Task* x) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    Array* a = array.load(std::memory_order_relaxed);
+    if (b - t > a->size - 1) {
+      Array* g = new Array(2 * a->size);
+      for (int64_t i = t; i < b; i++)
+        g->put(i, a->get(i));
+      arrays.emplace_back(g);
+      array.store(g, std::memory_order_release);
+      a = g;
+    }
+    a->put(b, x);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Solo il proprietario: il task inserito per ultimo, o nullptr
+  Task* take() {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    Array* a = array.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Task* x = a->get(b);
+    if (t == b) {
+      // L'ultimo task: lo contende ai ladri
+      if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+        x = nullptr;
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return x;
+  }
+
+  // Qualunque thread: il task più vecchio, o nullptr (anche se un altro
+  // thread lo ha preso nel frattempo)
+  Task* steal() {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b)
+      return nullptr;
+    Task* x = array.load(std::memory_order_acquire)->get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      return nullptr;
+    return x;
+  }
+};
+
+thread_local int self = -1;       // Deque del thread (-1: nessuno)
+thread_local unsigned depth = 0;  // Profondità del task in esecuzione
+
+struct Pool {
+  unsigned size;                  // Thread, compreso il primo thread esterno
+  unsigned cutoff;                // Profondità dei task eseguiti subito
+  std::unique_ptr<Deque[]> deques;
+  std::atomic<bool> root{false};  // Il deque 0 è stato assegnato
+  std::atomic<unsigned> sleeping{0};
+  std::mutex lock;
+  std::condition_variable wake;
+  uint64_t signals = 0;           // Risvegli dei thread in attesa
+
+  Pool() {
+    const char* s = getenv("KPAR_THREADS");
+    size = s ? atoi(s) : std::thread::hardware_concurrency();
+    size = std::max(size, 1u);
+    s = getenv("KPAR_CUTOFF");
+    cutoff = 4;
+    for (unsigned n = 1; n < size; n *= 2)
+      cutoff++;
+    if (s)
+      cutoff = atoi(s);
+    deques.reset(new Deque[size]);
+    for (unsigned t = 1; t < size; t++)
+      std::thread([this, t] { worker(t); }).detach();
+  }
+
+  // Il contatore viene decrementato per ultimo: da quel momento la
+  // funzione che attende può terminare
+  void run(Task* x) {
+    unsigned saved = depth;
+    depth = x->depth;
+    x->fn(x->args(), x->result);
+    depth = saved;
+    std::atomic<int64_t>* pending = x->pending;
+    free(x);
+    pending->fetch_sub(1, std::memory_order_release);
+  }
+
+  Task* steal(unsigned from) {
+    for (unsigned k = 1; k < size; k++)
+      if (Task* x = deques[(from + k) % size].steal())
+        return x;
+    return nullptr;
+  }
+
+  // Dopo un task inserito: se qualche thread dorme lo sveglia. La barriera
+  // (con quella di worker) garantisce che il thread che si addormenta veda
+  // il task o che qui si veda il thread addormentato
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) == 0)
+      return;
+    {
+      std::lock_guard<std::mutex> l(lock);
+      signals++;
+    }
+    wake.notify_all();
+  }
+
+  void worker(unsigned t) {
+    self = t;
+    for (unsigned idle = 0;;) {
+      if (Task* x = steal(t)) {
+        run(x);
+        idle = 0;
+      } else if (++idle < 64) {
+        std::this_thread::yield();
+      } else {
+        std::unique_lock<std::mutex> l(lock);
+        uint64_t seen = signals;
+        sleeping.fetch_add(1);
+        l.unlock();
+        Task* x = steal(t);
+        l.lock();
+        if (!x)
+          wake.wait(l, [&] { return signals != seen; });
+        sleeping.fetch_sub(1);
+        l.unlock();
+        if (x)
+          run(x);
+        idle = 0;
+      }
+    }
+  }
+
+  // Attende i task contati da pending, eseguendo intanto quelli del proprio
+  // deque (in fondo ci sono quelli generati dalla funzione) o degli altri
+  void sync(std::atomic<int64_t>* pending) {
+    while (pending->load(std::memory_order_acquire) > 0) {
+      Task* x = deques[self].take();
+      if (!x)
+        x = steal(self);
+      if (x)
+        run(x);
+      else
+        std::this_thread::yield();
+    }
+  }
+};
+
+// Il pool non viene mai distrutto: i suoi thread restano in attesa fino
+// alla fine del programma
+Pool& pool() {
+  static Pool* P = new Pool;
+  return *P;
+}
+
+std::atomic<int64_t>* counter(int64_t* pending) {
+  static_assert(sizeof(std::atomic<int64_t>) == sizeof(int64_t), "contatore");
+  return reinterpret_cast<std::atomic<int64_t>*>(pending);
+}
+
+}
+
+extern "C" void __kspawn(int64_t* pending, Fn fn, double* args, int64_t n, double* result) {
+  Pool& P = pool();
+  if (self < 0 && !P.root.exchange(true))
+    self = 0;
+  if (self < 0 || depth >= P.cutoff || P.size == 1) {
+    depth++;
+    fn(args, result);
+    depth--;
+    return;
+  }
+  Task* x = static_cast<Task*>(malloc(sizeof(Task) + n * sizeof(double)));
+  x->fn = fn;
+  x->result = result;
+  x->pending = counter(pending);
+  x->depth = depth + 1;
+  memcpy(x->args(), args, n * sizeof(double));
+  x->pending->fetch_add(1, std::memory_order_relaxed);
+  P.deques[self].push(x);
+  P.notify();
+}
+
+extern "C" void __ksync(int64_t* pending) {
+  if (counter(pending)->load(std::memory_order_acquire) == 0)
+    return;
+  pool().sync(counter(pending));
+}
@@ -8,7 +8,7 @@
 # include "parser.hpp"
 %}
 
-%option noyywrap nounput batch debug noinput
+%option noyywrap nounput batch debug noinput reentrant
 
 id      [a-zA-Z][a-zA-Z_0-9]*
 fpnum   [0-9]*\.?[0-9]+([eE][-+]?[0-9]+)?
@@ -37,6 +37,7 @@ blank   [ \t]
 "+"      return yy::parser::make_PLUS      (loc);
 "*"      return yy::parser::make_STAR      (loc);
 "/"      return yy::parser::make_SLASH     (loc);
+"%"      return yy::parser::make_PERCENT   (loc);
 "("      return yy::parser::make_LPAREN    (loc);
 ")"      return yy::parser::make_RPAREN    (loc);
 ";"      return yy::parser::make_SEMICOLON (loc);
@@ -64,11 +65,21 @@ blank   [ \t]
 "if"     { return yy::parser::make_IF(loc);}
 "else"   { return yy::parser::make_ELSE(loc);}
 "for"    { return yy::parser::make_FOR(loc);}
+"parfor" { return yy::parser::make_PARFOR(loc);}
+"reduce" { return yy::parser::make_REDUCE(loc);}
+"break"  { return yy::parser::make_BREAK(loc);}
+"continue" { return yy::parser::make_CONTINUE(loc);}
+"pure"   { return yy::parser::make_PURE(loc);}
+"inline" { return yy::parser::make_INLINE(loc);}
+"memo"   { return yy::parser::make_MEMO(loc);}
+"threadlocal" { return yy::parser::make_THREADLOCAL(loc);}
+"spawn"  { return yy::parser::make_SPAWN(loc);}
+"sync"   { return yy::parser::make_SYNC(loc);}
 "and"    { return yy::parser::make_AND(loc);}
 "or"     { return yy::parser::make_OR(loc);}
 "not"    { return yy::parser::make_NOT(loc);}
 
-{id}     { return yy::parser::make_IDENTIFIER (yytext, loc); }
+{id}     { return yy::parser::make_IDENTIFIER (drv.intern (StringRef (yytext, yyleng)), loc); }
 
 .        { throw yy::parser::syntax_error
                (loc, "invalid character: " + std::string(yytext));
@@ -77,19 +88,36 @@ blank   [ \t]
 <<EOF>>  { return yy::parser::make_END (loc); }
 %%
 
-void driver::scan_begin () {
-  yy_flex_debug = trace_scanning;
+// Restituisce falso, dopo aver segnalato l'errore, se il file non può essere
+// aperto: la compilazione di quel file fallisce, ma non quella degli altri
+// file compilati in parallelo (-j)
+bool driver::scan_begin () {
+  yylex_init (&scanner);
+  yyset_debug (trace_scanning, scanner);
+  // Programma in memoria (parse_string): il buffer creato da yy_scan_bytes
+  // è una copia del testo ed è liberato da yylex_destroy
+  if (source.data ())
+    {
+      yy_scan_bytes (source.data (), source.size (), scanner);
+      return true;
+    }
+  FILE* in;
   if (file.empty () || file == "-")
-    yyin = stdin;
-  else if (!(yyin = fopen (file.c_str (), "r")))
+    in = stdin;
+  else if (!(in = fopen (file.c_str (), "r")))
     {
       std::cerr << "cannot open " << file << ": " << strerror(errno) << '\n';
-      exit (EXIT_FAILURE);
+      yylex_destroy (scanner);
+      return false;
     }
+  yyset_in (in, scanner);
+  return true;
 }
 
 void
 driver::scan_end ()
 {
-  fclose (yyin);
+  if (!source.data ())
+    fclose (yyget_in (scanner));
+  yylex_destroy (scanner);
 }
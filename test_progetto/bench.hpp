@@ -0,0 +1,60 @@
+// Misura dei tempi di esecuzione dei programmi di test (make bench).
+// Ogni programma di benchmark collega un kernel K a un main non interattivo
+// che chiama run_bench: il kernel viene eseguito alcune volte a vuoto
+// (warm-up) e poi cronometrato per reps ripetizioni, ciascuna di n
+// operazioni. Il risultato è una riga CSV con mediana e 99-esimo percentile
+// del tempo di una ripetizione e tempo mediano per operazione, in ns.
+// Opzioni: -n N (operazioni per ripetizione), -r REPS, -w WARMUP,
+// -O LABEL (livello di ottimizzazione riportato nel risultato)
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+struct BenchOptions {
+  long n;
+  int reps = 21;
+  int warmup = 3;
+  const char* label = "";
+};
+
+inline BenchOptions bench_options(int argc, char* argv[], long n) {
+  BenchOptions opt;
+  opt.n = n;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "-n"))
+      opt.n = std::max(1L, atol(argv[i+1]));
+    else if (!strcmp(argv[i], "-r"))
+      opt.reps = std::max(1, atoi(argv[i+1]));
+    else if (!strcmp(argv[i], "-w"))
+      opt.warmup = std::max(0, atoi(argv[i+1]));
+    else if (!strcmp(argv[i], "-O"))
+      opt.label = argv[i+1];
+  }
+  return opt;
+}
+
+// I risultati dei kernel vengono accumulati qui, così che le chiamate non
+// possano essere eliminate
+inline volatile double bench_sink;
+
+template <class Kernel>
+int run_bench(const char* program, const BenchOptions& opt, Kernel kernel) {
+  for (int i = 0; i < opt.warmup; i++)
+    kernel(opt.n);
+  std::vector<double> ns(opt.reps);
+  for (auto& t : ns) {
+    auto start = std::chrono::steady_clock::now();
+    kernel(opt.n);
+    t = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  }
+  std::sort(ns.begin(), ns.end());
+  double median = ns[ns.size() / 2];
+  double p99 = ns[std::min(ns.size() - 1, (size_t) std::ceil(0.99 * ns.size()) - 1)];
+  printf("%s,%s,%ld,%d,%.0f,%.0f,%.3f\n", program, opt.label, opt.n, opt.reps,
+         median, p99, median / opt.n);
+  return 0;
+}
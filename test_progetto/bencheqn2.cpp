@@ -0,0 +1,23 @@
+#include "bench.hpp"
+
+extern "C" {
+    double eqn2(double,double,double);
+}
+
+// Al posto della stampa, le soluzioni vengono accumulate
+extern "C" double printval(double x1, double x2, double flag) {
+    bench_sink = bench_sink + x1 + x2 + flag;
+    return 0.0;
+}
+
+// n equazioni, a rotazione con soluzioni complesse, coincidenti e distinte
+int main(int argc, char* argv[]) {
+    BenchOptions opt = bench_options(argc, argv, 100000);
+    return run_bench("eqn2", opt, [](long n) {
+        static const double coeff[3][3] = {{1, 2, 5}, {1, 2, 1}, {1, -3, 2}};
+        for (long i = 0; i < n; i++) {
+            const double* c = coeff[i % 3];
+            eqn2(c[0], c[1] + (i % 7), c[2]);
+        }
+    });
+}
@@ -0,0 +1,16 @@
+#include "bench.hpp"
+
+extern "C" {
+    double fibo(double);
+}
+
+// n calcoli di fibonacci(m), con m = 10, 20, ..., 90
+int main(int argc, char* argv[]) {
+    BenchOptions opt = bench_options(argc, argv, 100000);
+    return run_bench("fibonacci", opt, [](long n) {
+        double s = 0;
+        for (long i = 0; i < n; i++)
+            s += fibo(10 + 10 * (i % 9));
+        bench_sink = s;
+    });
+}
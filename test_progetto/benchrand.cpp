@@ -0,0 +1,21 @@
+#include "bench.hpp"
+
+extern "C" {
+    double randk();
+}
+
+extern "C" {
+    double randinit(double);
+}
+
+// n numeri pseudocasuali, a partire da un seme fisso
+int main(int argc, char* argv[]) {
+    BenchOptions opt = bench_options(argc, argv, 1000000);
+    randinit(12345);
+    return run_bench("rand", opt, [](long n) {
+        double s = 0;
+        for (long i = 0; i < n; i++)
+            s += randk();
+        bench_sink = s;
+    });
+}
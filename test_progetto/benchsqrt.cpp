@@ -0,0 +1,16 @@
+#include "bench.hpp"
+
+extern "C" {
+    double sqrt(double);
+}
+
+// n radici quadrate di valori compresi fra 0.01 e 10000
+int main(int argc, char* argv[]) {
+    BenchOptions opt = bench_options(argc, argv, 100000);
+    return run_bench("sqrt", opt, [](long n) {
+        double s = 0;
+        for (long i = 0; i < n; i++)
+            s += sqrt(0.01 + (i % 1000) * 10.0);
+        bench_sink = s;
+    });
+}
@@ -0,0 +1,33 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+extern "C" {
+    double collatzall(double);
+    double setval(double, double);
+}
+
+// Passi della sequenza di Collatz di ogni i fra 1 e n, scritti in
+// parallelo dalle iterazioni del parfor di collatzall
+static std::vector<double> steps;
+
+double setval(double i, double x) {
+    steps[(size_t) i] = x;
+    return 0;
+}
+
+int main() {
+    double n;
+    std::cout << "Inserisci il valore di n: ";
+    std::cin >> n;
+    steps.assign((size_t) n + 1, 0);
+    auto start = std::chrono::steady_clock::now();
+    collatzall(n);
+    std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+    size_t best = 1;
+    for (size_t i = 1; i <= (size_t) n; i++)
+        if (steps[i] > steps[best])
+            best = i;
+    std::cout << "sequenza più lunga: " << best << " (" << steps[best] << " passi), in "
+              << secs.count() << " s" << std::endl;
+}
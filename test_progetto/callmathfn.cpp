@@ -0,0 +1,33 @@
+#include <cmath>
+#include <iostream>
+
+extern "C" {
+    double modk(double, double);
+    double fmodk(double, double);
+    double powk(double, double);
+    double hypotk(double, double);
+    double distk(double, double);
+    double floork(double);
+}
+
+// Confronta il risultato della funzione K con quello della libreria C
+static bool check(const char* name, double k, double c) {
+    std::cout << name << " = " << k << std::endl;
+    if (k == c || (std::isnan(k) && std::isnan(c)))
+        return true;
+    std::cout << "errore: atteso " << c << std::endl;
+    return false;
+}
+
+int main() {
+    double x, y;
+    std::cout << "Inserisci i valori di x e y: ";
+    std::cin >> x >> y;
+    bool ok = check("x % y", modk(x, y), std::fmod(x, y));
+    ok &= check("fmod(x, y)", fmodk(x, y), std::fmod(x, y));
+    ok &= check("pow(x, y)", powk(x, y), std::pow(x, y));
+    ok &= check("sqrt(x*x + y*y)", hypotk(x, y), std::sqrt(x * x + y * y));
+    ok &= check("fabs(x - y)", distk(x, y), std::fabs(x - y));
+    ok &= check("floor(x)", floork(x), std::floor(x));
+    return ok ? 0 : 1;
+}
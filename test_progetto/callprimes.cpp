@@ -0,0 +1,34 @@
+#include <iostream>
+#include <vector>
+
+extern "C" {
+    double primes(double);
+    double nextprime(double);
+}
+
+int main() {
+    double n;
+    std::cout << "Inserisci il valore di n: ";
+    std::cin >> n;
+    // Crivello di Eratostene, per confrontare i risultati
+    size_t m = n < 0 ? 0 : (size_t) n;
+    std::vector<bool> composite(2 * m + 3, false);
+    double count = 0, next = 0;
+    for (size_t i = 2; i < composite.size(); i++) {
+        if (composite[i])
+            continue;
+        if (i <= m)
+            count++;
+        else if (next == 0)
+            next = i;
+        for (size_t j = i * i; j < composite.size(); j += i)
+            composite[j] = true;
+    }
+    double c = primes(n), q = nextprime(n);
+    std::cout << "primi fino a " << n << ": " << c << std::endl;
+    std::cout << "primo successivo: " << q << std::endl;
+    if (c != count || q != next) {
+        std::cout << "errore: attesi " << count << " e " << next << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,23 @@
+#include <cmath>
+#include <iostream>
+
+extern "C" {
+    double sumsq(double);
+    double telescope(double);
+}
+
+int main() {
+    double n;
+    std::cout << "Inserisci il valore di n: ";
+    std::cin >> n;
+    // Somma dei quadrati fino a n, esatta per n non troppo grande, e
+    // prodotto dei (i+1)/i, che vale n+1 a meno degli arrotondamenti
+    double s = sumsq(n), p = telescope(n);
+    double es = n * (n + 1) * (2 * n + 1) / 6, ep = n + 1;
+    std::cout << "somma dei quadrati fino a " << n << ": " << s << std::endl;
+    std::cout << "prodotto dei (i+1)/i fino a " << n << ": " << p << std::endl;
+    if (s != es || std::fabs(p - ep) > 1e-9 * ep) {
+        std::cout << "errore: attesi " << es << " e " << ep << std::endl;
+        return 1;
+    }
+}